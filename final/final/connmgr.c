@@ -1,71 +1,274 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <poll.h>
+#include <errno.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 
 #include "config.h"
 #include "lib/tcpsock.h"
-#include "lib/dplist.h"
 #include "connmgr.h"
+#include "logger.h"
+#include "timeutil.h"
 #define LOG_MAX_LEN 1024
+// bytes of one reading on the wire: <sensor_id><temperature><timestamp>
+#define RECORD_SIZE (sizeof(sensor_id_t) + sizeof(sensor_value_t) + sizeof(sensor_ts_t))
+#define RX_BUF_SIZE (RECORD_SIZE * CONN_RX_RECORDS)
 int is_gateway_close();
-void write_fifo(const char* log_event);
 
 tcpsock_t *connmgr = NULL;
-static dplist_t *sensor_list = NULL;
+static int epoll_fd = -1;
+
+// readings decoded during one wakeup, handed to the sbuffer in a single batch
+static sensor_data_t rx_batch[CONN_BATCH_SIZE];
+static size_t rx_batch_len = 0;
 
+// monotonic ms of the next accept attempt after accept failed, 0 if none is due
+static int64_t accept_retry = 0;
 
-typedef struct{
+
+typedef struct sensor_node{
     sensor_id_t sensor_id;
     tcpsock_t* conn;
-    sensor_ts_t timestamp;
+    int sd;
+    int64_t last_active;// monotonic ms of the last reading, used for the timeout
+    struct sensor_node *idle_prev, *idle_next;// activity order, least recently active first
+    size_t rx_len;// bytes received of the reading that is not complete yet
+    int ready;// used up its read budget with data left, listed in ready_sds
+    unsigned char rx_buf[RX_BUF_SIZE];// reassembly buffer, always starts at a reading boundary
 }sensor_node_t;
-// copy funtion for sensor node in dplist
-void *conn_element_copy(void *element)
+
+// connections ordered by activity, the head holds the next timeout deadline
+static sensor_node_t *idle_head = NULL, *idle_tail = NULL;
+
+// active connections indexed by socket descriptor
+static sensor_node_t **conn_table = NULL;
+static int conn_table_size = 0;
+static int conn_count = 0;
+
+// descriptors of the connections that still have data after their read budget, in turn order
+// the connections of this turn are in ready_sds, the ones that run out of budget again go to ready_next
+static int *ready_sds = NULL, *ready_next = NULL;
+static int ready_cnt = 0, ready_next_cnt = 0;
+
+// size the connection table to the process descriptor limit
+static int conn_table_init()
+{
+    struct rlimit limit;
+    conn_table_size = MAX_CONN;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        conn_table_size = (int)limit.rlim_cur;
+    conn_table = calloc(conn_table_size, sizeof(sensor_node_t *));
+    // a connection is listed at most once, ready keeps it off the list while it is on it
+    ready_sds = malloc(conn_table_size * sizeof(int));
+    ready_next = malloc(conn_table_size * sizeof(int));
+    conn_count = ready_cnt = ready_next_cnt = 0;
+    return conn_table == NULL || ready_sds == NULL || ready_next == NULL ? -1 : 0;
+}
+
+static sensor_node_t *conn_lookup(int sd)
+{
+    if (sd < 0 || sd >= conn_table_size)
+        return NULL;
+    return conn_table[sd];
+}
+
+static int conn_insert(sensor_node_t *node)
+{
+    if (node->sd < 0 || node->sd >= conn_table_size || conn_table[node->sd] != NULL)
+        return -1;
+    conn_table[node->sd] = node;
+    conn_count++;
+    return 0;
+}
+
+// drop the connection from the table, close its socket and free it
+static void conn_remove(sensor_node_t *node)
+{
+    if (conn_lookup(node->sd) == node){
+        conn_table[node->sd] = NULL;
+        conn_count--;
+    }
+    tcp_close(&node->conn);
+    free(node);
+}
+
+static void idle_unlink(sensor_node_t *node)
+{
+    if (node->idle_prev)
+        node->idle_prev->idle_next = node->idle_next;
+    else
+        idle_head = node->idle_next;
+    if (node->idle_next)
+        node->idle_next->idle_prev = node->idle_prev;
+    else
+        idle_tail = node->idle_prev;
+    node->idle_prev = node->idle_next = NULL;
+}
+
+// mark node as most recently active, keeping the idle list sorted by last_active
+static void idle_touch(sensor_node_t *node, int64_t now)
+{
+    if (idle_tail != node){
+        if (node->idle_prev || idle_head == node)
+            idle_unlink(node);
+        node->idle_prev = idle_tail;
+        if (idle_tail)
+            idle_tail->idle_next = node;
+        else
+            idle_head = node;
+        idle_tail = node;
+    }
+    node->last_active = now;
+}
+
+static void connmgr_close_node(sensor_node_t *node)
+{
+    char log_buf[LOG_MAX_LEN];
+    snprintf(log_buf, LOG_MAX_LEN, "The sensor node with %" PRIu16 " has closed the connection.\n", node->sensor_id);
+    log_event(log_buf);
+    // closing the descriptor also drops it from the epoll set
+    idle_unlink(node);
+    conn_remove(node);
+}
+
+/*
+ * Accept every pending connection, the listening socket is edge-triggered
+ * When accept fails (EMFILE, ENFILE, ENOBUFS, ...) the pending connections stay queued and are accepted
+ * again after CONN_ACCEPT_RETRY_MS, the edge they arrived with is gone
+ */
+static void connmgr_accept(int64_t now)
 {
-    sensor_node_t *sensor = (sensor_node_t *)element;
-    sensor_node_t *copy = malloc(sizeof(sensor_node_t));
-    copy->conn = sensor->conn;
-    copy->timestamp = sensor->timestamp;
-    return (void *)copy;
+    // a failure that lasts is logged once
+    int retrying = accept_retry != 0;
+    accept_retry = 0;
+    while (1){
+        tcpsock_t *sock;
+        //A newly created socket identifying the remote system that initiated the connection request is returned
+        if (tcp_wait_for_connection(connmgr, &sock) != TCP_NO_ERROR){
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            // the peer gave up before it was accepted, others may still be queued
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (!retrying){
+                char log_buf[LOG_MAX_LEN];
+                snprintf(log_buf, LOG_MAX_LEN, "Accept of a sensor node failed: %s, retrying every %d ms.\n", strerror(errno), CONN_ACCEPT_RETRY_MS);
+                log_event(log_buf);
+            }
+            accept_retry = now + CONN_ACCEPT_RETRY_MS;
+            return;
+        }
+        sensor_node_t *node = malloc(sizeof(sensor_node_t));
+        assert(node != NULL);
+        node->sensor_id = 0;
+        node->conn = sock;
+        tcp_get_sd(sock, &node->sd);
+        node->idle_prev = node->idle_next = NULL;
+        node->rx_len = 0;
+        node->ready = 0;
+        fcntl(node->sd, F_SETFL, fcntl(node->sd, F_GETFL) | O_NONBLOCK);
+        if (conn_insert(node) != 0){
+            conn_remove(node);
+            continue;
+        }
+        idle_touch(node, now);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = node;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, node->sd, &ev) < 0){
+            idle_unlink(node);
+            conn_remove(node);
+        }
+    }
 }
 
-// free function for sensor node in dplist
-void conn_element_free(void **element)
+static void connmgr_flush_batch(sbuffer_t *write_buf)
 {
-    sensor_node_t *node = (sensor_node_t *)(*element);
-    if (node->conn)
-        tcp_close(&node->conn);
-    free((*element));
-    *element = NULL;
+    if (rx_batch_len == 0)
+        return;
+    sbuffer_insert_batch(write_buf, rx_batch, rx_batch_len);
+    rx_batch_len = 0;
 }
-// compare funtion for sensor node in dplist
-int conn_element_compare(void *x, void *y)
+
+// decode one reading in wire order <sensor_id><temperature><timestamp>
+static void connmgr_decode(const unsigned char *record, sensor_data_t *data)
 {
-    tcpsock_t *xconn = ((sensor_node_t *)x)->conn;
-    tcpsock_t *yconn = ((sensor_node_t *)y)->conn;
-    int xfd, yfd;
-    tcp_get_sd(xconn, &xfd);
-    tcp_get_sd(yconn, &yfd);
-    return xfd != yfd;
+    memcpy(&data->id, record, sizeof(data->id));
+    record += sizeof(data->id);
+    memcpy(&data->value, record, sizeof(data->value));
+    record += sizeof(data->value);
+    memcpy(&data->ts, record, sizeof(data->ts));
 }
 
-//get sensor node from sensor dplist by sock fd
-sensor_node_t *get_sensor_node_by_fd(int sock_fd)
+/*
+ * Drain an edge-triggered, non-blocking connection until the socket is empty or CONN_READ_BUDGET readings were read,
+ * so one fast sender can't starve the other connections.
+ * Every complete reading is staged in rx_batch, the tail of a partial reading is kept in rx_buf until the next edge.
+ * Returns 0 when the socket is empty, 1 when the budget ran out with data left, -1 when it was closed or failed
+ */
+static int connmgr_read_node(sensor_node_t *node, sbuffer_t *write_buf, int64_t now)
 {
-    int size = dpl_size(sensor_list);
-    int sfd = -1;
-    for (int i = 0; i < size; i++){
-        sensor_node_t *node = dpl_get_element_at_index(sensor_list, i);
-        if (node != NULL && tcp_get_sd(node->conn, &sfd) == TCP_NO_ERROR){
-            if (sfd == sock_fd)
-                return node;
+    char log_buf[LOG_MAX_LEN];
+    size_t budget = CONN_READ_BUDGET;
+    while (1){
+        if (budget == 0)
+            return 1;
+        int bytes = RX_BUF_SIZE - node->rx_len;
+        int result = tcp_receive(node->conn, node->rx_buf + node->rx_len, &bytes);
+        if (result == TCP_CONNECTION_CLOSED)
+            return -1;
+        if (result != TCP_NO_ERROR){
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        node->rx_len += bytes;
+        size_t offset = 0;
+        for (; node->rx_len - offset >= RECORD_SIZE; offset += RECORD_SIZE){
+            if (rx_batch_len == CONN_BATCH_SIZE)
+                connmgr_flush_batch(write_buf);
+            sensor_data_t *data = &rx_batch[rx_batch_len++];
+            connmgr_decode(node->rx_buf + offset, data);
+            if (node->sensor_id == 0){
+                snprintf(log_buf, LOG_MAX_LEN, "A sensor node with %" PRIu16 " has opened a new connection.\n", data->id);
+                log_event(log_buf);
+            }
+            node->sensor_id = data->id;
+            if (budget > 0)
+                budget--;
+        }
+        if (offset > 0){
+            // keep the partial reading at the start of the buffer
+            node->rx_len -= offset;
+            memmove(node->rx_buf, node->rx_buf + offset, node->rx_len);
+            idle_touch(node, now);
         }
     }
-    return NULL;
+}
+
+// reads from 'node' after a wakeup with epoll 'events', a node with data left after its budget is listed for the next turn
+static void connmgr_serve_node(sensor_node_t *node, sbuffer_t *write_buf, int64_t now, uint32_t events)
+{
+    int ret = connmgr_read_node(node, write_buf, now);
+    if (ret == 1){
+        // a hang up is seen by a later read once the data before it is read
+        if (!node->ready){
+            node->ready = 1;
+            ready_next[ready_next_cnt++] = node->sd;
+        }
+        return;
+    }
+    // if sensor node closed
+    if (ret != 0 || (events & (EPOLLHUP | EPOLLERR)))
+        connmgr_close_node(node);
 }
 
 /*
@@ -76,140 +279,81 @@ sensor_node_t *get_sensor_node_by_fd(int sock_fd)
 void connmgr_listen(int port_number, sbuffer_t *write_buf)
 {
     int sock_fd;
-    int ready_fds, cur_fds;
-    time_t cur_time, last_time;
-    struct pollfd sensor_fd[MAX_CONN];
-    // create sensor dplist
-	sensor_list = dpl_create(conn_element_copy, conn_element_free, conn_element_compare);
+    int64_t cur_time, last_time;
+    struct epoll_event events[MAX_EVENTS];
+    // create connection table
+    if (conn_table_init() != 0)
+        return;
 
     //Creates a new socket and opens this socket in 'passive listening mode' (waiting for an active connection setup request)
     if (tcp_passive_open(&connmgr, port_number) != TCP_NO_ERROR){
 		return;
     }
-    //get listen sock fd
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        return;
+    //get listen sock fd, the listening socket is the only event without connection state
     tcp_get_sd(connmgr, &sock_fd);
-    sensor_fd[0].fd = sock_fd;
-    sensor_fd[0].events = POLLIN;
-    cur_fds = 1;
-    //initial other sock fd
-    for (int i = 1; i < MAX_CONN; i++){
-        sensor_fd[i].fd = -1;
-    }
-    time(&last_time);
+    fcntl(sock_fd, F_SETFL, fcntl(sock_fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock_fd, &ev) < 0)
+        return;
+
+    last_time = timeutil_now_ms();
 	while (!is_gateway_close()){
 		char log_buf[LOG_MAX_LEN];
-        // use poll to check if there are sensor fds which ready to receive data per 10ms 
-        ready_fds = poll(sensor_fd, cur_fds, 10);
-        // if there are sensor fds which ready to receive data
-        if (ready_fds > 0){
+        // sleep until the next connection times out, or the connmgr itself when nobody is connected
+        int64_t deadline = (idle_head ? idle_head->last_active : last_time) + TIMEOUT * 1000;
+        if (accept_retry != 0 && accept_retry < deadline)
+            deadline = accept_retry;
+        cur_time = timeutil_now_ms();
+        int wait_ms = deadline >= cur_time ? (int)(deadline - cur_time) + 1 : 0;
+        // connections with data left only get a new edge once more data arrives
+        if (ready_cnt > 0)
+            wait_ms = 0;
+        int ready_fds = epoll_wait(epoll_fd, events, MAX_EVENTS, wait_ms);
+        cur_time = timeutil_now_ms();
+        // the connmgr idle timeout starts when the last sensor node leaves
+        if (conn_count > 0)
+            last_time = cur_time;
+        for (int i = 0; i < ready_fds; i++){
+            sensor_node_t *node = events[i].data.ptr;
             // check if there are sensor node connect to connmgr
-            if (sensor_fd[0].revents & POLLIN){
-                tcpsock_t *sock;
-                //A newly created socket identifying the remote system that initiated the connection request is returned
-                if (tcp_wait_for_connection(connmgr, &sock) != TCP_NO_ERROR)
-                    exit(EXIT_FAILURE);
-                
-                tcp_get_sd(sock, &sock_fd);
-                // set sensor fd in free position
-                for (int i = 1; i < MAX_CONN; i++){
-                    if (sensor_fd[i].fd < 0){
-                        sensor_fd[i].fd = sock_fd;
-                        sensor_fd[i].events = POLLIN;
-                        if (cur_fds <= i)
-                            cur_fds++;
-                        break;
-                    }
-                }
-                // initial dplist node in insert
-                sensor_node_t snode;
-                snode.sensor_id = 0;
-                snode.conn = sock;
-                time(&snode.timestamp);
-                dpl_insert_sorted(sensor_list, &snode, 1);
-                ready_fds--;
-            }
-            if (!ready_fds)
+            if (node == NULL){
+                connmgr_accept(cur_time);
                 continue;
-
-            for (int i = 1; i < cur_fds; i++){
-                if (sensor_fd[i].fd < 0)
-                    continue;
-                // if sensor fd is valid
-                sensor_node_t *node = get_sensor_node_by_fd(sensor_fd[i].fd);
-                assert(node != NULL);
-                tcpsock_t *sensor_sock = node->conn;
-                // if sensor fd is ready to receive data
-                if (sensor_fd[i].revents & POLLIN){
-                    int bytes, result;
-                    sensor_data_t data;
-                    // receive data
-                    bytes = sizeof(data.id);
-                    result = tcp_receive(sensor_sock, (void*)&data.id, &bytes);
-                    bytes = sizeof(data.value);
-                    result = tcp_receive(sensor_sock, (void*)&data.value, &bytes);
-                    bytes = sizeof(data.ts);
-                    result = tcp_receive(sensor_sock, (void*)&data.ts, &bytes);
-                    //receive data success
-                    if ((result == TCP_NO_ERROR) && bytes){
-						sbuffer_insert(write_buf, &data);
-                        // update timestamp
-						if (node->sensor_id == 0){
-							snprintf(log_buf, LOG_MAX_LEN, "A sensor node with %" PRIu16 " has opened a new connection.\n", data.id);
-							write_fifo(log_buf);
-						}
-                        node->timestamp = data.ts;
-                        node->sensor_id = data.id;
-                        //printf("sensor id = %" PRIu16 " - temperature = %g - timestamp = %ld\n", data.id, data.value, (long int)data.ts);
-                    }else if (result == TCP_CONNECTION_CLOSED){
-                        // if sensor node closed
-						snprintf(log_buf, LOG_MAX_LEN, "The sensor node with %" PRIu16 " has closed the connection.\n", node->sensor_id);
-						write_fifo(log_buf);
-                        //printf("sensor node %d is closed\n", node->sensor_id);
-                        sensor_fd[i].fd = -1;
-                        dpl_remove_element(sensor_list, node, 1);
-                        
-                        if (i >= cur_fds - 1)
-                            cur_fds--;
-                    }
-
-                }
-                
             }
+            // a listed connection gets its turn below, once per pass
+            if (!node->ready)
+                connmgr_serve_node(node, write_buf, cur_time, events[i].events);
         }
-        // check if sensor node connection is time out
-        for (int i = 1; i < cur_fds; i++){
-            if (sensor_fd[i].fd < 0)
-                continue;
-            sensor_node_t *node = get_sensor_node_by_fd(sensor_fd[i].fd);
-            assert(node != NULL);
-            
-            time(&cur_time);
-            // get difftime to judge if sensor node connection timeout
-            if (difftime(cur_time, node->timestamp) > TIMEOUT){
-                //printf("sensor node %d is timeout\n", node->sensor_id);
-				snprintf(log_buf, LOG_MAX_LEN, "The sensor node with %" PRIu16 " has closed the connection.\n", node->sensor_id);
-				write_fifo(log_buf);
-                sensor_fd[i].fd = -1;
-                dpl_remove_element(sensor_list, node, 1);
-                if (i >= cur_fds - 1)
-                    cur_fds--;
+        // another turn for the connections that had data left, in the order they ran out of budget
+        for (int i = 0; i < ready_cnt; i++){
+            sensor_node_t *node = conn_lookup(ready_sds[i]);
+            if (node != NULL && node->ready){
+                node->ready = 0;
+                connmgr_serve_node(node, write_buf, cur_time, 0);
             }
-
         }
+        int *ready_tmp = ready_sds;
+        ready_sds = ready_next;
+        ready_cnt = ready_next_cnt;
+        ready_next = ready_tmp;
+        ready_next_cnt = 0;
+        if (accept_retry != 0 && cur_time >= accept_retry)
+            connmgr_accept(cur_time);
+        connmgr_flush_batch(write_buf);
+        // only the least recently active connections can have timed out
+        while (idle_head && cur_time - idle_head->last_active > TIMEOUT * 1000)
+            connmgr_close_node(idle_head);
 
-        time(&cur_time);
         // check if connmgr timeout
-        if (dpl_size(sensor_list) == 0){
-            if (difftime(cur_time, last_time) > TIMEOUT){
-                //printf("connection manager timeout\n");
-				snprintf(log_buf, LOG_MAX_LEN, "connection manager timeout\n");
-				write_fifo(log_buf);
-                break;
-            }
-                
-        }
-        else{
-            last_time = cur_time;
+        if (conn_count == 0 && cur_time - last_time > TIMEOUT * 1000){
+			snprintf(log_buf, LOG_MAX_LEN, "connection manager timeout\n");
+			log_event(log_buf);
+            break;
         }
 
     }
@@ -222,7 +366,22 @@ void connmgr_listen(int port_number, sbuffer_t *write_buf)
 */
 void connmgr_free()
 {
-    dpl_free(&sensor_list, 1);
+    for (int sd = 0; conn_count > 0 && sd < conn_table_size; sd++){
+        if (conn_table[sd])
+            conn_remove(conn_table[sd]);
+    }
+    free(conn_table);
+    free(ready_sds);
+    free(ready_next);
+    ready_sds = ready_next = NULL;
+    ready_cnt = ready_next_cnt = 0;
+    conn_table = NULL;
+    conn_table_size = 0;
+    idle_head = idle_tail = NULL;
+    if (epoll_fd >= 0){
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
 	if (tcp_close(&connmgr) != TCP_NO_ERROR)
 		return;
-}
\ No newline at end of file
+}
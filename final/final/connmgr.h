@@ -1,7 +1,12 @@
 #ifndef CONNMGR_H
 #define CONNMGR_H
 
-#define MAX_CONN 1024
+#define MAX_CONN 1024 // connection table size when the descriptor limit is unknown
+#define MAX_EVENTS 64 // readiness events handled per epoll_wait
+#define CONN_RX_RECORDS 256 // readings that fit in the receive buffer of one connection
+#define CONN_BATCH_SIZE 1024 // readings passed to the sbuffer in one batch
+#define CONN_READ_BUDGET (4 * CONN_RX_RECORDS) // readings read from one connection per wakeup at most
+#define CONN_ACCEPT_RETRY_MS 100 // delay before accepting again after accept failed, e.g. out of descriptors
 #include "sbuffer.h"
 
 #ifndef TIMEOUT
@@ -21,6 +26,7 @@ void connmgr_listen(int port_number, sbuffer_t *write_buf);
 void connmgr_free();
 
 /*
- * Also this connection manager should be using your dplist to store all the info on the active sensor nodes.
+ * The info on the active sensor nodes is kept in a table indexed by socket descriptor,
+ * sized to the process descriptor limit.
  */
-#endif /* CONNMGR_H */
\ No newline at end of file
+#endif /* CONNMGR_H */
\ No newline at end of file
@@ -1,48 +1,727 @@
+#define _GNU_SOURCE
+
 #include <inttypes.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <float.h>
+#include <math.h>
 #include "config.h"
-#include "lib/dplist.h"
 #include "datamgr.h"
+#include "logger.h"
+#include "timeutil.h"
+#include "stats.h"
 #define LOG_MAX_LEN 1024
-void write_fifo(const char* log_event);
 
 typedef uint16_t room_id_t;
 typedef uint16_t data_cnt_t;
 
-static dplist_t *sensor_list = NULL;
+// threshold state of a sensor, reported when it changes
+typedef enum{
+    ALERT_NORMAL,
+    ALERT_HOT,
+    ALERT_COLD
+} alert_state_t;
+
+/*
+ * Aggregates of a room, updated with every reading of its sensors
+ */
+typedef struct{
+    room_id_t room_id;
+    bool in_use;// the room occurs in the room_sensor.map
+    uint16_t sensor_cnt;// sensors in 'sensor_ids'
+    uint16_t active;// sensors with a running average
+    uint32_t updates;// readings since 'avg_sum' was last recomputed
+    sensor_id_t *sensor_ids;// sensors of the room
+    sensor_value_t avg_sum;// sum of the running averages of the active sensors
+    sensor_value_t min;// lowest and highest reading
+    sensor_value_t max;
+    sensor_ts_t timestamp;// timestamp of the last reading
+} room_node_data_t;
+
+/*
+ * Bucket of a time window, holds the readings with ts / bucket_width == 'index'
+ */
+typedef struct{
+    int64_t index;
+    uint32_t cnt;
+    sensor_value_t sum;
+    sensor_value_t min;// valid while cnt > 0
+    sensor_value_t max;
+} window_bucket_t;
+
 /*
 *  The structure for sensor node
 */
 typedef struct{
     sensor_id_t sensor_id;//sensor id
     room_id_t room_id;// room id
-    sensor_value_t running_data[RUN_AVG_LENGTH];// data to compute a running average
-    data_cnt_t cnt;//
+    room_node_data_t *room;// aggregates of the room
+    bool in_use;// the sensor occurs in the room_sensor.map
+    data_cnt_t window;// number of readings in the running average
+    data_cnt_t pos;// slot of the oldest reading once running_data is full
+    uint32_t cnt;// readings in the running average, stops counting at 'window' for a window of readings
+    sensor_value_t running_sum;// sum of the readings in the running average, updated per reading
+    sensor_value_t *running_data;// the last 'window' readings to compute a running average, NULL for a time window
+    uint32_t window_sec;// length of a time window, 0 for a window of 'window' readings
+    uint32_t bucket_width;// seconds per bucket of the time window
+    uint16_t bucket_cnt;
+    int64_t bucket_head;// index of the newest bucket
+    sensor_ts_t window_since;// first reading of the time window
+    window_bucket_t *buckets;// ring of the time window, slot index % bucket_cnt
     sensor_ts_t timestamp;// a last - modified timestamp that contains the timestamp of the last received sensor data used
         //to update the running average of this sensor
+    sensor_value_t min_temp;// thresholds of the room, copied here so the hot loop needs no lookup
+    sensor_value_t max_temp;
+    uint8_t alert;// alert_state_t reported last
+    uint8_t alert_next;// state the running average points at, reported once it lasts 'alert_dwell' seconds
+    uint16_t alert_dwell;// seconds a new state has to last before it is reported
+    uint32_t alert_summary;// seconds between the summaries of a lasting alert, 0 for none
+    sensor_value_t alert_hysteresis;// an alert ends this far inside the threshold
+    sensor_value_t alert_peak;// hottest or coldest running average of the current alert
+    sensor_ts_t alert_next_since;// first reading of 'alert_next'
+    sensor_ts_t alert_since;// start of the current alert
+    sensor_ts_t alert_reported;// last transition or summary
+    double stats_alpha;// EWMA weight 'stats' was created with
+    stats_t *stats;// statistics enabled for the room, NULL if none
+    bool window_minmax;// min/max come from the buckets of the time window instead of 'stats'
 } sensor_node_data_t;
-// copy funtion for sensor node in dplist
-void *data_element_copy(void *element)
+
+/*
+ * Settings of a room from the room_config.map, 'set' flags the keys given for it
+ * Keys that are not set for a room are taken from the default entry
+ */
+#define ROOM_CONFIG_WINDOW 0x01
+#define ROOM_CONFIG_HYSTERESIS 0x02
+#define ROOM_CONFIG_DWELL 0x04
+#define ROOM_CONFIG_SUMMARY 0x08
+#define ROOM_CONFIG_MIN 0x10
+#define ROOM_CONFIG_MAX 0x20
+#define ROOM_CONFIG_STATS 0x40
+#define ROOM_CONFIG_EWMA 0x80
+#define ROOM_CONFIG_WINDOW_SEC 0x100
+
+typedef struct{
+    room_id_t room_id;
+    unsigned set;
+    data_cnt_t window;
+    uint16_t dwell;
+    uint32_t summary;
+    sensor_value_t hysteresis;
+    sensor_value_t min_temp;
+    sensor_value_t max_temp;
+    unsigned stats;// STATS_* mask
+    double ewma_alpha;
+    uint32_t window_sec;// time window, replaces 'window' when not 0
+} room_config_t;
+
+#define ROOM_CONFIG_DEFAULT {0, ROOM_CONFIG_WINDOW | ROOM_CONFIG_HYSTERESIS | ROOM_CONFIG_DWELL | ROOM_CONFIG_SUMMARY | \
+    ROOM_CONFIG_MIN | ROOM_CONFIG_MAX | ROOM_CONFIG_STATS | ROOM_CONFIG_EWMA | ROOM_CONFIG_WINDOW_SEC, RUN_AVG_LENGTH, \
+    DATAMGR_ALERT_DWELL, DATAMGR_ALERT_SUMMARY, DATAMGR_ALERT_HYSTERESIS, SET_MIN_TEMP, SET_MAX_TEMP, DATAMGR_STATS, \
+    DATAMGR_EWMA_ALPHA, DATAMGR_WINDOW_SEC}
+
+static room_config_t room_default = ROOM_CONFIG_DEFAULT;
+static room_config_t *room_configs = NULL;
+static int room_config_count = 0;
+
+// the room_config.map is read again when it changes
+static char *room_config_path = NULL;
+static struct stat room_config_stat;
+
+// returns the settings for 'room_id', creates them when 'create' is set
+static room_config_t *room_config_get(room_id_t room_id, bool create)
+{
+    for (int i = 0; i < room_config_count; i++){
+        if (room_configs[i].room_id == room_id)
+            return &room_configs[i];
+    }
+    if (!create)
+        return NULL;
+    room_config_t *configs = realloc(room_configs, (room_config_count + 1) * sizeof(room_config_t));
+    ERROR_HANDLER(configs == NULL, "error");
+    room_configs = configs;
+    memset(&room_configs[room_config_count], 0, sizeof(room_config_t));
+    room_configs[room_config_count].room_id = room_id;
+    return &room_configs[room_config_count++];
+}
+
+// settings of the sensors in 'room_id', the default entry fills in the keys the room doesn't set
+static room_config_t room_config_resolve(room_id_t room_id)
+{
+    room_config_t resolved = room_default;
+    room_config_t *config = room_config_get(room_id, false);
+    if (config == NULL)
+        return resolved;
+    if (config->set & ROOM_CONFIG_WINDOW)
+        resolved.window = config->window;
+    if (config->set & ROOM_CONFIG_HYSTERESIS)
+        resolved.hysteresis = config->hysteresis;
+    if (config->set & ROOM_CONFIG_DWELL)
+        resolved.dwell = config->dwell;
+    if (config->set & ROOM_CONFIG_SUMMARY)
+        resolved.summary = config->summary;
+    if (config->set & ROOM_CONFIG_MIN)
+        resolved.min_temp = config->min_temp;
+    if (config->set & ROOM_CONFIG_MAX)
+        resolved.max_temp = config->max_temp;
+    if (config->set & ROOM_CONFIG_STATS)
+        resolved.stats = config->stats;
+    if (config->set & ROOM_CONFIG_EWMA)
+        resolved.ewma_alpha = config->ewma_alpha;
+    if (config->set & ROOM_CONFIG_WINDOW_SEC)
+        resolved.window_sec = config->window_sec;
+    return resolved;
+}
+
+// drops every room setting, the defaults are the compile time values again
+static void room_config_reset()
+{
+    free(room_configs);
+    room_configs = NULL;
+    room_config_count = 0;
+    room_default = (room_config_t)ROOM_CONFIG_DEFAULT;
+}
+
+// applies one "key=value" setting to 'config', returns -1 for an unknown key or a bad value
+static int room_config_set(room_config_t *config, const char *key, const char *value)
+{
+    char *end;
+    if (strcmp(key, "window") == 0){
+        unsigned long window = strtoul(value, &end, 10);
+        if (*end != '\0' || window == 0 || window > DATAMGR_MAX_WINDOW)
+            return -1;
+        config->window = window;
+        config->set |= ROOM_CONFIG_WINDOW;
+        return 0;
+    }
+    if (strcmp(key, "window_sec") == 0){
+        unsigned long window_sec = strtoul(value, &end, 10);
+        if (*end != '\0' || window_sec > DATAMGR_MAX_WINDOW_SEC)
+            return -1;
+        config->window_sec = window_sec;
+        config->set |= ROOM_CONFIG_WINDOW_SEC;
+        return 0;
+    }
+    if (strcmp(key, "hysteresis") == 0){
+        double hysteresis = strtod(value, &end);
+        if (*end != '\0' || !(hysteresis >= 0))
+            return -1;
+        config->hysteresis = hysteresis;
+        config->set |= ROOM_CONFIG_HYSTERESIS;
+        return 0;
+    }
+    if (strcmp(key, "dwell") == 0){
+        unsigned long dwell = strtoul(value, &end, 10);
+        if (*end != '\0' || dwell > UINT16_MAX)
+            return -1;
+        config->dwell = dwell;
+        config->set |= ROOM_CONFIG_DWELL;
+        return 0;
+    }
+    if (strcmp(key, "summary") == 0){
+        unsigned long summary = strtoul(value, &end, 10);
+        if (*end != '\0' || summary > UINT32_MAX)
+            return -1;
+        config->summary = summary;
+        config->set |= ROOM_CONFIG_SUMMARY;
+        return 0;
+    }
+    if (strcmp(key, "min") == 0 || strcmp(key, "max") == 0){
+        double temp = strtod(value, &end);
+        if (*end != '\0' || temp != temp)
+            return -1;
+        if (key[1] == 'i'){
+            config->min_temp = temp;
+            config->set |= ROOM_CONFIG_MIN;
+        } else{
+            config->max_temp = temp;
+            config->set |= ROOM_CONFIG_MAX;
+        }
+        return 0;
+    }
+    if (strcmp(key, "stats") == 0){
+        if (stats_parse(value, &config->stats) != STATS_SUCCESS)
+            return -1;
+        config->set |= ROOM_CONFIG_STATS;
+        return 0;
+    }
+    if (strcmp(key, "ewma") == 0){
+        double alpha = strtod(value, &end);
+        if (*end != '\0' || !(alpha > 0 && alpha <= 1))
+            return -1;
+        config->ewma_alpha = alpha;
+        config->set |= ROOM_CONFIG_EWMA;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Sensor registry indexed by sensor id: the high byte selects a page, the low byte the entry in it.
+ * Pages are only allocated for id ranges that occur in the room_sensor.map, so a lookup is two array indexes
+ */
+#define SENSOR_PAGE_BITS 8
+#define SENSOR_PAGE_SIZE (1 << SENSOR_PAGE_BITS)
+#define SENSOR_PAGES ((UINT16_MAX >> SENSOR_PAGE_BITS) + 1)
+
+static sensor_node_data_t *sensor_table[SENSOR_PAGES];
+static int sensor_count = 0;
+
+// rooms are indexed the same way, the page arrays don't move so sensors keep a pointer to their room
+static room_node_data_t *room_table[SENSOR_PAGES];
+static int room_count = 0;
+
+// returns the room with 'room_id', or NULL when it is not in the room_sensor.map
+static room_node_data_t *room_lookup(room_id_t room_id)
+{
+    room_node_data_t *page = room_table[room_id >> SENSOR_PAGE_BITS];
+    if (page == NULL)
+        return NULL;
+    page += room_id & (SENSOR_PAGE_SIZE - 1);
+    return page->in_use ? page : NULL;
+}
+
+// returns the room with 'room_id', registers it first if needed
+static room_node_data_t *room_add(room_id_t room_id)
+{
+    room_node_data_t **page = &room_table[room_id >> SENSOR_PAGE_BITS];
+    if (*page == NULL){
+        *page = calloc(SENSOR_PAGE_SIZE, sizeof(room_node_data_t));
+        ERROR_HANDLER(*page == NULL, "error");
+    }
+    room_node_data_t *proom = *page + (room_id & (SENSOR_PAGE_SIZE - 1));
+    if (!proom->in_use){
+        proom->in_use = true;
+        proom->room_id = room_id;
+        proom->min = DBL_MAX;
+        proom->max = -DBL_MAX;
+        room_count++;
+    }
+    return proom;
+}
+
+// returns the sensor with 'sensor_id', or NULL when it is not in the room_sensor.map
+static sensor_node_data_t *sensor_lookup(sensor_id_t sensor_id)
+{
+    sensor_node_data_t *page = sensor_table[sensor_id >> SENSOR_PAGE_BITS];
+    if (page == NULL)
+        return NULL;
+    page += sensor_id & (SENSOR_PAGE_SIZE - 1);
+    return page->in_use ? page : NULL;
+}
+
+// running average of 'psensor' over the readings it has, 0 without any
+static sensor_value_t sensor_avg(const sensor_node_data_t *psensor)
+{
+    return psensor->cnt == 0 ? 0 : psensor->running_sum / psensor->cnt;
+}
+
+// takes the running average of 'psensor' out of its room, before the average is reset or the sensor moves
+static void room_remove_avg(sensor_node_data_t *psensor)
+{
+    if (psensor->room == NULL || psensor->cnt == 0)
+        return;
+    psensor->room->avg_sum -= sensor_avg(psensor);
+    psensor->room->active--;
+}
+
+// sums the running averages of the room's sensors again, so rounding errors of the updates can't accumulate
+static void room_resum(room_node_data_t *proom)
+{
+    sensor_value_t sum = 0;
+    for (int i = 0; i < proom->sensor_cnt; i++)
+        sum += sensor_avg(sensor_lookup(proom->sensor_ids[i]));
+    proom->avg_sum = sum;
+    proom->updates = 0;
+}
+
+/*
+ * Updates the aggregates of the room of 'psensor' after it got the reading 'data'
+ * 'old_avg' is the running average of the sensor before the reading, 'was_active' whether it had one
+ */
+static void room_add_reading(sensor_node_data_t *psensor, bool was_active, sensor_value_t old_avg, const sensor_data_t *data)
+{
+    room_node_data_t *proom = psensor->room;
+    if (!was_active){
+        proom->active++;
+        old_avg = 0;
+    }
+    proom->avg_sum += sensor_avg(psensor) - old_avg;
+    if (data->value < proom->min)
+        proom->min = data->value;
+    if (data->value > proom->max)
+        proom->max = data->value;
+    proom->timestamp = data->ts;
+    if (++proom->updates == DATAMGR_ROOM_RESUM)
+        room_resum(proom);
+}
+
+/*
+ * Sets up an empty time window of 'window_sec' seconds for 'psensor' in at most DATAMGR_WINDOW_BUCKETS buckets,
+ * the window spans the newest bucket and the bucket_cnt - 1 before it
+ */
+static void sensor_time_window_init(sensor_node_data_t *psensor, uint32_t window_sec)
+{
+    psensor->bucket_width = (window_sec + DATAMGR_WINDOW_BUCKETS - 1) / DATAMGR_WINDOW_BUCKETS;
+    psensor->bucket_cnt = (window_sec + psensor->bucket_width - 1) / psensor->bucket_width;
+    psensor->buckets = malloc(psensor->bucket_cnt * sizeof(window_bucket_t));
+    ERROR_HANDLER(psensor->buckets == NULL, "error");
+    for (int i = 0; i < psensor->bucket_cnt; i++){
+        psensor->buckets[i].index = INT64_MIN;
+        psensor->buckets[i].cnt = 0;
+        psensor->buckets[i].sum = 0;
+    }
+    psensor->bucket_head = INT64_MIN;
+}
+
+/*
+ * Copies the settings of its room into 'psensor', the hot loop doesn't look them up
+ * A changed window starts a new running average
+ */
+static void sensor_apply_config(sensor_node_data_t *psensor)
+{
+    room_config_t config = room_config_resolve(psensor->room_id);
+    bool reset = (psensor->running_data == NULL && psensor->buckets == NULL) || psensor->window != config.window ||
+        psensor->window_sec != config.window_sec;
+    if (reset){
+        room_remove_avg(psensor);
+        free(psensor->running_data);
+        free(psensor->buckets);
+        psensor->running_data = NULL;
+        psensor->buckets = NULL;
+        psensor->window = config.window;
+        psensor->window_sec = config.window_sec;
+        if (psensor->window_sec != 0){
+            sensor_time_window_init(psensor, psensor->window_sec);
+        } else{
+            psensor->running_data = malloc(psensor->window * sizeof(sensor_value_t));
+            ERROR_HANDLER(psensor->running_data == NULL, "error");
+        }
+        psensor->cnt = psensor->pos = 0;
+        psensor->running_sum = 0;
+    }
+    psensor->min_temp = config.min_temp;
+    psensor->max_temp = config.max_temp;
+    psensor->alert_hysteresis = config.hysteresis;
+    psensor->alert_dwell = config.dwell;
+    psensor->alert_summary = config.summary;
+    // statistics start over when their settings change, sliding min/max use the running average window,
+    // the buckets keep them for a time window
+    unsigned mask = config.stats;
+    psensor->window_minmax = psensor->window_sec != 0 && (mask & STATS_MINMAX);
+    if (psensor->window_minmax)
+        mask &= ~STATS_MINMAX;
+    if (reset || stats_mask(psensor->stats) != mask || psensor->stats_alpha != config.ewma_alpha){
+        stats_free(&psensor->stats);
+        psensor->stats_alpha = config.ewma_alpha;
+        if (mask != 0)
+            ERROR_HANDLER(stats_create(&psensor->stats, mask, config.window, config.ewma_alpha) != STATS_SUCCESS, "error");
+    }
+}
+
+// registers 'sensor_id' in 'room_id', a sensor listed twice keeps the last room
+static void sensor_add(sensor_id_t sensor_id, room_id_t room_id)
+{
+    sensor_node_data_t **page = &sensor_table[sensor_id >> SENSOR_PAGE_BITS];
+    if (*page == NULL){
+        *page = calloc(SENSOR_PAGE_SIZE, sizeof(sensor_node_data_t));
+        ERROR_HANDLER(*page == NULL, "error");
+    }
+    sensor_node_data_t *psensor = *page + (sensor_id & (SENSOR_PAGE_SIZE - 1));
+    if (!psensor->in_use){
+        sensor_count++;
+    } else{
+        // leave the old room
+        room_node_data_t *old_room = psensor->room;
+        room_remove_avg(psensor);
+        for (int i = 0; i < old_room->sensor_cnt; i++){
+            if (old_room->sensor_ids[i] == sensor_id){
+                old_room->sensor_ids[i] = old_room->sensor_ids[--old_room->sensor_cnt];
+                break;
+            }
+        }
+    }
+    free(psensor->running_data);
+    free(psensor->buckets);
+    stats_free(&psensor->stats);
+    memset(psensor, 0, sizeof(sensor_node_data_t));
+    psensor->in_use = true;
+    psensor->room_id = room_id;
+    psensor->sensor_id = sensor_id;
+    psensor->room = room_add(room_id);
+    sensor_id_t *ids = realloc(psensor->room->sensor_ids, (psensor->room->sensor_cnt + 1) * sizeof(sensor_id_t));
+    ERROR_HANDLER(ids == NULL, "error");
+    ids[psensor->room->sensor_cnt++] = sensor_id;
+    psensor->room->sensor_ids = ids;
+    sensor_apply_config(psensor);
+}
+
+// slot of bucket 'index' in the ring of 'psensor', the index is negative before the first bucket_width seconds of 1970
+static window_bucket_t *sensor_bucket(sensor_node_data_t *psensor, int64_t index)
+{
+    int64_t slot = index % psensor->bucket_cnt;
+    return &psensor->buckets[slot < 0 ? slot + psensor->bucket_cnt : slot];
+}
+
+/*
+ * Adds the reading 'data' to the time window of 'psensor' and returns true once the window spans 'window_sec'
+ * Buckets are expired lazily: a newer bucket clears the slots it moves past, at most bucket_cnt of them, so a
+ * reading costs O(1) whatever the reading rate. A replayed reading still inside the window joins its bucket,
+ * one older than the window is left out of the average. The sum is recomputed from the buckets once per
+ * bucket_cnt new buckets so rounding errors of the updates can't accumulate
+ */
+static bool sensor_add_timed_reading(sensor_node_data_t *psensor, const sensor_data_t *data)
+{
+    // rounded down, so a bucket covers bucket_width seconds on both sides of 0
+    int64_t index = data->ts / psensor->bucket_width;
+    if (data->ts % psensor->bucket_width < 0)
+        index--;
+    if (psensor->cnt == 0)
+        psensor->window_since = data->ts;
+    if (index > psensor->bucket_head){
+        int64_t expire = psensor->bucket_head == INT64_MIN ? psensor->bucket_cnt : index - psensor->bucket_head;
+        if (expire > psensor->bucket_cnt)
+            expire = psensor->bucket_cnt;
+        for (int64_t i = index - expire + 1; i <= index; i++){
+            window_bucket_t *bucket = sensor_bucket(psensor, i);
+            psensor->cnt -= bucket->cnt;
+            psensor->running_sum -= bucket->sum;
+            bucket->index = i;
+            bucket->cnt = 0;
+            bucket->sum = 0;
+        }
+        // an average over the readings since a gap longer than the window
+        if (psensor->cnt == 0)
+            psensor->window_since = data->ts;
+        if (psensor->bucket_head / psensor->bucket_cnt != index / psensor->bucket_cnt){
+            sensor_value_t sum = 0;
+            for (int i = 0; i < psensor->bucket_cnt; i++)
+                sum += psensor->buckets[i].sum;
+            psensor->running_sum = sum;
+        }
+        psensor->bucket_head = index;
+    } else if (index <= psensor->bucket_head - psensor->bucket_cnt){
+        return data->ts >= psensor->window_since + (sensor_ts_t)psensor->window_sec;
+    }
+    window_bucket_t *bucket = sensor_bucket(psensor, index);
+    if (bucket->cnt == 0 || data->value < bucket->min)
+        bucket->min = data->value;
+    if (bucket->cnt == 0 || data->value > bucket->max)
+        bucket->max = data->value;
+    bucket->cnt++;
+    bucket->sum += data->value;
+    psensor->cnt++;
+    psensor->running_sum += data->value;
+    return data->ts >= psensor->window_since + (sensor_ts_t)psensor->window_sec;
+}
+
+/*
+ * Adds 'value' to the running average of 'psensor' and returns true once a full window of readings is collected
+ * The sum is updated with the new and the evicted reading only, it is recomputed from the window once per
+ * 'window' readings so rounding errors of the updates can't accumulate
+ */
+static bool sensor_add_reading(sensor_node_data_t *psensor, sensor_value_t value)
+{
+    if (psensor->cnt < psensor->window){
+        psensor->running_data[psensor->cnt++] = value;
+        psensor->running_sum += value;
+        return psensor->cnt == psensor->window;
+    }
+    psensor->running_sum += value - psensor->running_data[psensor->pos];
+    psensor->running_data[psensor->pos] = value;
+    if (++psensor->pos == psensor->window){
+        sensor_value_t sum = 0;
+        for (int i = 0; i < psensor->window; i++)
+            sum += psensor->running_data[i];
+        psensor->running_sum = sum;
+        psensor->pos = 0;
+    }
+    return true;
+}
+
+static const char *alert_names[] = {"normal", "too hot", "too cold"};
+
+/*
+ * Checks the running average 'run_avg' of the reading at 'ts' against the thresholds and logs state changes only:
+ * an alert starts when the average crosses a threshold and ends once it is 'alert_hysteresis' back inside,
+ * a new state is only reported after it lasted 'alert_dwell' seconds. A lasting alert is summarized every 'alert_summary' seconds
+ */
+static void sensor_check_alert(sensor_node_data_t *psensor, sensor_value_t run_avg, sensor_ts_t ts)
+{
+    char log_buf[LOG_MAX_LEN];
+    alert_state_t state = psensor->alert;
+    if (run_avg > psensor->max_temp)
+        state = ALERT_HOT;
+    else if (run_avg < psensor->min_temp)
+        state = ALERT_COLD;
+    else if ((state == ALERT_HOT && run_avg < psensor->max_temp - psensor->alert_hysteresis) ||
+             (state == ALERT_COLD && run_avg > psensor->min_temp + psensor->alert_hysteresis))
+        state = ALERT_NORMAL;
+
+    if (state == psensor->alert){
+        psensor->alert_next = state;
+        if (state == ALERT_NORMAL)
+            return;
+        if ((state == ALERT_HOT && run_avg > psensor->alert_peak) || (state == ALERT_COLD && run_avg < psensor->alert_peak))
+            psensor->alert_peak = run_avg;
+        if (psensor->alert_summary == 0 || ts - psensor->alert_reported < (sensor_ts_t)psensor->alert_summary)
+            return;
+        snprintf(log_buf, LOG_MAX_LEN,
+            "The sensor node with %" PRIu16 " reports it's %s for %ld s (running avg temperature = %g, peak %g).\n",
+            psensor->sensor_id, alert_names[state], (long)(ts - psensor->alert_since), run_avg, psensor->alert_peak);
+        log_event(log_buf);
+        psensor->alert_reported = ts;
+        return;
+    }
+    // a new state has to last before it is reported
+    if (state != psensor->alert_next){
+        psensor->alert_next = state;
+        psensor->alert_next_since = ts;
+    }
+    if (ts - psensor->alert_next_since < (sensor_ts_t)psensor->alert_dwell)
+        return;
+    if (state == ALERT_NORMAL)
+        snprintf(log_buf, LOG_MAX_LEN,
+            "The sensor node with %" PRIu16 " is back to normal after %ld s %s (running avg temperature = %g).\n",
+            psensor->sensor_id, (long)(ts - psensor->alert_since), alert_names[psensor->alert], run_avg);
+    else
+        snprintf(log_buf, LOG_MAX_LEN,
+            "The sensor node with %" PRIu16 " reports it's %s (running avg temperature = %g).\n",
+            psensor->sensor_id, alert_names[state], run_avg);
+    log_event(log_buf);
+    psensor->alert = state;
+    psensor->alert_since = psensor->alert_next_since;
+    psensor->alert_reported = ts;
+    psensor->alert_peak = run_avg;
+}
+
+// processes one reading of 'psensor': running average, room aggregates and alerts
+static void sensor_update(sensor_node_data_t *psensor, const sensor_data_t *data)
+{
+    bool was_active = psensor->cnt > 0;
+    sensor_value_t old_avg = sensor_avg(psensor);
+    bool full = psensor->buckets != NULL ? sensor_add_timed_reading(psensor, data) : sensor_add_reading(psensor, data->value);
+    room_add_reading(psensor, was_active, old_avg, data);
+    if (psensor->stats != NULL)
+        stats_add(psensor->stats, data->value);
+    if (full)
+        sensor_check_alert(psensor, sensor_avg(psensor), data->ts);
+    psensor->timestamp = data->ts;
+}
+
+// read the room_sensor.map, one "<room id> <sensor id>" pair per line
+static void sensor_table_load(FILE *fp_sensor_map)
 {
-    sensor_node_data_t *sensor = (sensor_node_data_t *)element;
-    sensor_node_data_t *copy = malloc(sizeof(sensor_node_data_t));
-    memcpy(copy->running_data, sensor->running_data, sizeof(sensor_value_t) * RUN_AVG_LENGTH);
-    copy->cnt = sensor->cnt;
-    copy->room_id = sensor->room_id;
-    copy->sensor_id = sensor->sensor_id;
-    copy->timestamp = sensor->timestamp;
-    return (void *)copy;
+    unsigned int sensor_id, room_id;
+    while (fscanf(fp_sensor_map, "%04u %04u \n", &room_id, &sensor_id) == 2){
+        ERROR_HANDLER(sensor_id > UINT16_MAX || room_id > UINT16_MAX, "invalid room_sensor.map");
+        sensor_add(sensor_id, room_id);
+    }
 }
-// free function for sensor node in dplist
-void data_element_free(void **element)
+
+/*
+ * Reads the room settings, one "<room id|default> key=value ..." line per room, '#' starts a comment line
+ * Invalid lines are logged and skipped
+ */
+int datamgr_load_room_config(FILE * fp_room_config)
 {
-    free((*element));
-    *element = NULL;
+    char line[LOG_MAX_LEN], log_buf[LOG_MAX_LEN];
+    char name[32], key[32], value[32];
+    int line_nr = 0, ret = 0;
+    if (fp_room_config == NULL)
+        return -1;
+    while (fgets(line, LOG_MAX_LEN, fp_room_config) != NULL){
+        room_config_t *config, parsed;
+        char *p = line, *end;
+        int n;
+        line_nr++;
+        if (sscanf(p, " %31s%n", name, &n) != 1 || name[0] == '#')
+            continue;
+        p += n;
+        if (strcmp(name, "default") == 0){
+            config = &room_default;
+        } else{
+            unsigned long room_id = strtoul(name, &end, 10);
+            config = (*end != '\0' || room_id > UINT16_MAX) ? NULL : room_config_get(room_id, true);
+        }
+        // a line is applied completely or not at all
+        if (config != NULL){
+            parsed = *config;
+            while (sscanf(p, " %31[^= \t\r\n]=%31s%n", key, value, &n) == 2 &&
+                   room_config_set(&parsed, key, value) == 0)
+                p += n;
+            if (sscanf(p, " %31s", key) != 1){
+                *config = parsed;
+                continue;
+            }
+        }
+        snprintf(log_buf, LOG_MAX_LEN, "Invalid room configuration on line %d ignored.\n", line_nr);
+        log_event(log_buf);
+        ret = -1;
+    }
+    // thresholds that don't leave a normal range between them fall back to the defaults
+    for (int i = 0; i < room_config_count; i++){
+        room_config_t resolved = room_config_resolve(room_configs[i].room_id);
+        if (resolved.min_temp < resolved.max_temp)
+            continue;
+        snprintf(log_buf, LOG_MAX_LEN, "Room %" PRIu16 " thresholds min %g >= max %g ignored.\n",
+            room_configs[i].room_id, resolved.min_temp, resolved.max_temp);
+        log_event(log_buf);
+        room_configs[i].set &= ~(ROOM_CONFIG_MIN | ROOM_CONFIG_MAX);
+        ret = -1;
+    }
+    if (!(room_default.min_temp < room_default.max_temp)){
+        log_event("Default thresholds min >= max ignored.\n");
+        room_default.min_temp = SET_MIN_TEMP;
+        room_default.max_temp = SET_MAX_TEMP;
+        ret = -1;
+    }
+    return ret;
 }
-// compare funtion for sensor node in dplist
-int data_element_compare(void *x, void *y)
+
+/*
+ * Reads the room settings from 'path' and remembers it, the datamgr reads it again once it changes
+ * A missing file leaves every room on the defaults
+ */
+int datamgr_watch_room_config(const char * path)
+{
+    free(room_config_path);
+    room_config_path = strdup(path);
+    ERROR_HANDLER(room_config_path == NULL, "error");
+    memset(&room_config_stat, 0, sizeof(room_config_stat));
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+    stat(path, &room_config_stat);
+    int ret = datamgr_load_room_config(fp);
+    fclose(fp);
+    return ret;
+}
+
+// reads the watched room_config.map again if it changed and applies it to every sensor
+static void room_config_reload()
 {
-    return (((sensor_node_data_t *)x)->sensor_id) != (((sensor_node_data_t *)y)->sensor_id);
+    struct stat st;
+    if (room_config_path == NULL || stat(room_config_path, &st) != 0)
+        return;
+    if (st.st_mtime == room_config_stat.st_mtime && st.st_size == room_config_stat.st_size &&
+        st.st_ino == room_config_stat.st_ino)
+        return;
+    FILE *fp = fopen(room_config_path, "r");
+    if (fp == NULL)
+        return;
+    room_config_stat = st;
+    room_config_reset();
+    datamgr_load_room_config(fp);
+    fclose(fp);
+    for (int i = 0; i < SENSOR_PAGES; i++){
+        if (sensor_table[i] == NULL)
+            continue;
+        for (int j = 0; j < SENSOR_PAGE_SIZE; j++){
+            if (sensor_table[i][j].in_use)
+                sensor_apply_config(&sensor_table[i][j]);
+        }
+    }
+    log_event("Room configuration reloaded.\n");
 }
 /*
  *  This method holds the core functionality of your datamgr. It takes in 2 file pointers to the sensor files and parses them. 
@@ -50,152 +729,125 @@ int data_element_compare(void *x, void *y)
  */
 void datamgr_parse_sensor_files(FILE * fp_sensor_map, FILE * fp_sensor_data)
 {
-    unsigned int sensor_id, room_id;
     sensor_data_t sensor_data;
     sensor_node_data_t *psensor = NULL;
-    sensor_node_data_t sensor;
-    //create sensor node list
-	sensor_list = dpl_create(data_element_copy, data_element_free, data_element_compare);
     ERROR_HANDLER(fp_sensor_map == NULL, "error");
     ERROR_HANDLER(fp_sensor_data == NULL, "error");
     // read data from sensor map
-    while (fscanf(fp_sensor_map, "%04u %04u \n", &room_id, &sensor_id) == 2){
-        //create sensor node and initialed
-        psensor = malloc(sizeof(sensor_node_data_t));
-        ERROR_HANDLER(psensor == NULL, "error");
-        memset(psensor, 0, sizeof(sensor_node_data_t));
-        psensor->room_id = room_id;
-        psensor->sensor_id = sensor_id;
-        psensor->cnt = 0;
-        // insert sensor node into sensor node list
-        dpl_insert_at_index(sensor_list, (void *)psensor, 0, false);
-    }
+    sensor_table_load(fp_sensor_map);
     // read sensor data from sensor_data file
     while (fread(&sensor_data.id, sizeof(uint16_t), 1, fp_sensor_data)){
         fread(&sensor_data.value, sizeof(double), 1, fp_sensor_data);
         fread(&sensor_data.ts, sizeof(time_t), 1, fp_sensor_data);
-        sensor.sensor_id = sensor_data.id;
-        sensor.timestamp = sensor_data.ts;
         // find the sensor
-        int idx = dpl_get_index_of_element(sensor_list, (void *)&sensor);
-        if (idx == -1){
+        psensor = sensor_lookup(sensor_data.id);
+        if (psensor == NULL){
             printf("Sensor id %"PRIu16" did not occur in room_sensor.map\n", sensor_data.id);
         }
         else{
-            // collecting sensor data
-            psensor = dpl_get_element_at_index(sensor_list, idx);
-            psensor->running_data[psensor->cnt % RUN_AVG_LENGTH] = sensor_data.value;
-            psensor->cnt++;
-            // computes for every sensor node a running average
-            if (psensor->cnt >= RUN_AVG_LENGTH){
-                sensor_value_t run_avg = 0;
-                for (int i = 0; i < RUN_AVG_LENGTH; i++){
-                    run_avg += psensor->running_data[i];
-                }
-                // too hot 
-                if (run_avg / RUN_AVG_LENGTH > SET_MAX_TEMP){
-                    fprintf(stderr,"room %"PRIu16" too hot.\n", psensor->room_id);
-                }
-                // too cold
-                else if (run_avg / RUN_AVG_LENGTH < SET_MIN_TEMP){
-                    fprintf(stderr,"room %"PRIu16" too cold.\n", psensor->room_id);
-                }
-            }
-            psensor->timestamp = sensor_data.ts;
+            // collecting sensor data and computes for every sensor node a running average
+            sensor_update(psensor, &sensor_data);
         }
     }
 }
 
 
 /*
-* Reads continiously all data from the shared buffer data structure, parse the room_id's
+* Reads continiously all data from the shared buffer data structure through 'reader', parse the room_id's
 * and calculate the running avarage for all sensor ids
-* When *buffer becomes NULL the method finishes. This method will NOT automatically free all used memory
+* When no more data arrives the method finishes. This method will NOT automatically free all used memory
 */
-void datamgr_parse_sensor_data(FILE * fp_sensor_map, sbuffer_t ** buffer1, sbuffer_t ** buffer2)
+void datamgr_parse_sensor_data(FILE * fp_sensor_map, sbuffer_reader_t * reader)
 {
-	unsigned int sensor_id, room_id;
 	sensor_data_t sensor_data;
 	sensor_node_data_t *psensor = NULL;
-	sensor_node_data_t sensor;
 	char log_buf[LOG_MAX_LEN];
-	//create sensor node list
-	sensor_list = dpl_create(data_element_copy, data_element_free, data_element_compare);
-	ERROR_HANDLER(fp_sensor_map == NULL, "error");
-	ERROR_HANDLER((*buffer1) == NULL, "error");
-	ERROR_HANDLER((*buffer2) == NULL, "error");
-
-	// read data from sensor map
-	while (fscanf(fp_sensor_map, "%04u %04u \n", &room_id, &sensor_id) == 2){
-		//create sensor node and initialed
-		psensor = malloc(sizeof(sensor_node_data_t));
-		ERROR_HANDLER(psensor == NULL, "error");
-		memset(psensor, 0, sizeof(sensor_node_data_t));
-		psensor->room_id = room_id;
-		psensor->sensor_id = sensor_id;
-		psensor->cnt = 0;
-		// insert sensor node into sensor node list
-		dpl_insert_at_index(sensor_list, (void *)psensor, 0, false);
-	}
-	// read sensor data from sensor_data file
-	while (1){
-		if (sbuffer_remove(*buffer1, &sensor_data) != SBUFFER_SUCCESS)
-			break;
-		
-		sensor.sensor_id = sensor_data.id;
-		sensor.timestamp = sensor_data.ts;
-		// find the sensor
-		int idx = dpl_get_index_of_element(sensor_list, (void *)&sensor);
-		if (idx == -1){
-			snprintf(log_buf, LOG_MAX_LEN, "Received sensor data with invalid sensor node ID %" PRIu16 ".\n", sensor_data.id);
-			write_fifo(log_buf);
-			//printf("Sensor id %"PRIu16" did not occur in room_sensor.map\n", sensor_data.id);
+	sensor_data_t batch[SBUFFER_BATCH_SIZE];
+	size_t count;
+	ERROR_HANDLER(reader == NULL, "error");
+
+	// read data from sensor map, unless datamgr_load_sensor_map did
+	if (fp_sensor_map != NULL)
+		sensor_table_load(fp_sensor_map);
+	// read sensor data from the shared buffer, a batch at a time
+	int64_t config_checked = 0;
+	int ret;
+	while ((ret = sbuffer_read_batch(reader, batch, SBUFFER_BATCH_SIZE, &count, room_config_path != NULL ? DATAMGR_CONFIG_CHECK_MS : SBUFFER_WAIT_FOREVER)) == SBUFFER_SUCCESS ||
+		   ret == SBUFFER_NO_DATA){
+		// a changed room_config.map is applied between batches, without a restart
+		if (room_config_path != NULL && timeutil_now_ms() - config_checked >= DATAMGR_CONFIG_CHECK_MS){
+			config_checked = timeutil_now_ms();
+			room_config_reload();
 		}
-		else{
-			// collecting sensor data
-			if (sbuffer_insert(*buffer2, &sensor_data) != SBUFFER_SUCCESS)
-				break;
-
-			psensor = dpl_get_element_at_index(sensor_list, idx);
-			psensor->running_data[psensor->cnt % RUN_AVG_LENGTH] = sensor_data.value;
-			psensor->cnt++;
-			// computes for every sensor node a running average
-			if (psensor->cnt >= RUN_AVG_LENGTH){
-				sensor_value_t run_avg = 0;
-				for (int i = 0; i < RUN_AVG_LENGTH; i++){
-					run_avg += psensor->running_data[i];
-				}
-				run_avg /= RUN_AVG_LENGTH;
-				// too hot 
-				if (run_avg > SET_MAX_TEMP){
-					snprintf(log_buf, LOG_MAX_LEN, 
-						"The sensor node with %" PRIu16 " reports it's too hot (running avg temperature = %g).\n", 
-						psensor->sensor_id, run_avg);
-					write_fifo(log_buf);
-					//fprintf(stderr, "room %"PRIu16" too hot.\n", psensor->room_id);
-				}
-				// too cold
-				else if (run_avg < SET_MIN_TEMP){
-					snprintf(log_buf, LOG_MAX_LEN,
-						"The sensor node with %" PRIu16 " reports it's too cold (running avg temperature = %g).\n",
-						psensor->sensor_id, run_avg);
-					write_fifo(log_buf);
-					//fprintf(stderr, "room %"PRIu16" too cold.\n", psensor->room_id);
-				}
+		if (ret == SBUFFER_NO_DATA)
+			continue;
+		for (size_t n = 0; n < count; n++){
+			sensor_data = batch[n];
+			// find the sensor
+			psensor = sensor_lookup(sensor_data.id);
+			if (psensor == NULL){
+				snprintf(log_buf, LOG_MAX_LEN, "Received sensor data with invalid sensor node ID %" PRIu16 ".\n", sensor_data.id);
+				log_event(log_buf);
+				//printf("Sensor id %"PRIu16" did not occur in room_sensor.map\n", sensor_data.id);
+			}
+			else{
+				// collecting sensor data and computes for every sensor node a running average
+				// only changes of the alert state are logged
+				sensor_update(psensor, &sensor_data);
 			}
-			psensor->timestamp = sensor_data.ts;
 		}
 	}
 }
 
+/*
+ * Reads the room_sensor.map ahead of datamgr_parse_sensor_data
+ */
+void datamgr_load_sensor_map(FILE * fp_sensor_map)
+{
+    ERROR_HANDLER(fp_sensor_map == NULL, "error");
+    sensor_table_load(fp_sensor_map);
+}
+
+
+/*
+ * Returns 1 if 'sensor_id' occurs in the room_sensor.map, 0 otherwise
+ * Safe from other threads once the map is loaded, the set of sensors doesn't change after that
+ */
+int datamgr_sensor_known(sensor_id_t sensor_id)
+{
+    return sensor_lookup(sensor_id) != NULL;
+}
+
 /*
  * This method should be called to clean up the datamgr, and to free all used memory. 
  * After this, any call to datamgr_get_room_id, datamgr_get_avg, datamgr_get_last_modified or datamgr_get_total_sensors will not return a valid result
  */
 void datamgr_free()
 {
-    dpl_free(&sensor_list, true);
-    sensor_list = NULL;
+    for (int i = 0; i < SENSOR_PAGES; i++){
+        if (sensor_table[i] == NULL)
+            continue;
+        for (int j = 0; j < SENSOR_PAGE_SIZE; j++){
+            free(sensor_table[i][j].running_data);
+            free(sensor_table[i][j].buckets);
+            stats_free(&sensor_table[i][j].stats);
+        }
+        free(sensor_table[i]);
+        sensor_table[i] = NULL;
+    }
+    sensor_count = 0;
+    for (int i = 0; i < SENSOR_PAGES; i++){
+        if (room_table[i] == NULL)
+            continue;
+        for (int j = 0; j < SENSOR_PAGE_SIZE; j++)
+            free(room_table[i][j].sensor_ids);
+        free(room_table[i]);
+        room_table[i] = NULL;
+    }
+    room_count = 0;
+    room_config_reset();
+    free(room_config_path);
+    room_config_path = NULL;
 }
     
 /*   
@@ -204,41 +856,21 @@ void datamgr_free()
  */
 uint16_t datamgr_get_room_id(sensor_id_t sensor_id)
 {
-    sensor_node_data_t snode;
-    sensor_node_data_t *p_snode;
-    int idx;
-    snode.sensor_id = sensor_id;
-    idx = dpl_get_index_of_element(sensor_list, (void *)&snode);
-    ERROR_HANDLER(idx == -1, "error");
-    p_snode = dpl_get_element_at_index(sensor_list, idx);
+    sensor_node_data_t *p_snode = sensor_lookup(sensor_id);
+    ERROR_HANDLER(p_snode == NULL, "error");
     return p_snode->room_id;
 }
 
 
 /*
- * Gets the running AVG of a certain senor ID (if less then RUN_AVG_LENGTH measurements are recorded the avg is 0)
+ * Gets the running AVG of a certain senor ID (if less then a window of measurements are recorded it averages the ones received, 0 if none)
  * Use ERROR_HANDLER() if sensor_id is invalid 
  */
 sensor_value_t datamgr_get_avg(sensor_id_t sensor_id)
 {
-    sensor_node_data_t snode;
-    sensor_node_data_t *p_snode;
-    sensor_value_t run_avg = 0;
-    data_cnt_t cnt;
-    snode.sensor_id = sensor_id;
-    int idx = dpl_get_index_of_element(sensor_list, (void *)&snode);
-    ERROR_HANDLER(idx == -1, "error");
-    p_snode = dpl_get_element_at_index(sensor_list, idx);
-    if (p_snode->cnt >= RUN_AVG_LENGTH)
-        cnt = RUN_AVG_LENGTH;
-    else
-        cnt = p_snode->cnt;
-    
-    for (int i = 0; i < cnt; i++){
-        run_avg += p_snode->running_data[i];
-    }
-    
-    return run_avg / cnt;
+    sensor_node_data_t *p_snode = sensor_lookup(sensor_id);
+    ERROR_HANDLER(p_snode == NULL, "error");
+    return sensor_avg(p_snode);
 }
 
 
@@ -248,14 +880,8 @@ sensor_value_t datamgr_get_avg(sensor_id_t sensor_id)
  */
 time_t datamgr_get_last_modified(sensor_id_t sensor_id)
 {
-    sensor_node_data_t snode;
-    sensor_node_data_t *p_snode;
-    int idx;
-    snode.sensor_id = sensor_id;
-    idx = dpl_get_index_of_element(sensor_list, (void *)&snode);
-    ERROR_HANDLER(idx == -1, "error");
-
-    p_snode = dpl_get_element_at_index(sensor_list, idx);
+    sensor_node_data_t *p_snode = sensor_lookup(sensor_id);
+    ERROR_HANDLER(p_snode == NULL, "error");
     return p_snode->timestamp;
 }
 
@@ -265,7 +891,163 @@ time_t datamgr_get_last_modified(sensor_id_t sensor_id)
  */
 int datamgr_get_total_sensors()
 {
-    return dpl_size(sensor_list);
+    return sensor_count;
+}
+
+
+/*
+ * Gets the mean of the running averages of the sensors in a certain room ID that got readings, 0 if none did
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+sensor_value_t datamgr_get_room_avg(uint16_t room_id)
+{
+    room_node_data_t *p_room = room_lookup(room_id);
+    ERROR_HANDLER(p_room == NULL, "error");
+    if (p_room->active == 0)
+        return 0;
+    return p_room->avg_sum / p_room->active;
+}
+
+
+/*
+ * Gets the lowest reading of the sensors in a certain room ID, 0 before the first reading
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+sensor_value_t datamgr_get_room_min(uint16_t room_id)
+{
+    room_node_data_t *p_room = room_lookup(room_id);
+    ERROR_HANDLER(p_room == NULL, "error");
+    return p_room->min <= p_room->max ? p_room->min : 0;
+}
+
+
+/*
+ * Gets the highest reading of the sensors in a certain room ID, 0 before the first reading
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+sensor_value_t datamgr_get_room_max(uint16_t room_id)
+{
+    room_node_data_t *p_room = room_lookup(room_id);
+    ERROR_HANDLER(p_room == NULL, "error");
+    return p_room->min <= p_room->max ? p_room->max : 0;
+}
+
+
+/*
+ * Returns the time of the last reading in a certain room ID
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+time_t datamgr_get_room_last_modified(uint16_t room_id)
+{
+    room_node_data_t *p_room = room_lookup(room_id);
+    ERROR_HANDLER(p_room == NULL, "error");
+    return p_room->timestamp;
+}
+
+
+/*
+ * Returns the number of sensors in a certain room ID that got readings
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+int datamgr_get_room_active_sensors(uint16_t room_id)
+{
+    room_node_data_t *p_room = room_lookup(room_id);
+    ERROR_HANDLER(p_room == NULL, "error");
+    return p_room->active;
+}
+
+
+/*
+ *  Return the total amount of unique room ID's in the room_sensor.map
+ */
+int datamgr_get_total_rooms()
+{
+    return room_count;
+}
+
+
+// min or max of the readings in the time window of 'psensor', O(bucket_cnt), NAN before the first reading
+// expired buckets are cleared as the window moves, so every bucket with readings is in the window
+static sensor_value_t sensor_window_extreme(const sensor_node_data_t *psensor, bool is_min)
+{
+    sensor_value_t extreme = NAN;
+    for (int i = 0; i < psensor->bucket_cnt; i++){
+        const window_bucket_t *bucket = &psensor->buckets[i];
+        if (bucket->cnt == 0)
+            continue;
+        sensor_value_t value = is_min ? bucket->min : bucket->max;
+        if (isnan(extreme) || (is_min ? value < extreme : value > extreme))
+            extreme = value;
+    }
+    return extreme;
+}
+
+// the statistics of 'sensor_id', NULL if none are enabled for it
+static const stats_t *sensor_stats(sensor_id_t sensor_id)
+{
+    sensor_node_data_t *p_snode = sensor_lookup(sensor_id);
+    ERROR_HANDLER(p_snode == NULL, "error");
+    return p_snode->stats;
+}
+
+
+/*
+ * The statistic getters return NAN if the statistic isn't enabled for the room of the sensor or there is no reading yet
+ * Use ERROR_HANDLER() if sensor_id is invalid
+ */
+sensor_value_t datamgr_get_min(sensor_id_t sensor_id)
+{
+    sensor_node_data_t *p_snode = sensor_lookup(sensor_id);
+    ERROR_HANDLER(p_snode == NULL, "error");
+    return p_snode->window_minmax ? sensor_window_extreme(p_snode, true) : stats_get_min(p_snode->stats);
+}
+
+
+sensor_value_t datamgr_get_max(sensor_id_t sensor_id)
+{
+    sensor_node_data_t *p_snode = sensor_lookup(sensor_id);
+    ERROR_HANDLER(p_snode == NULL, "error");
+    return p_snode->window_minmax ? sensor_window_extreme(p_snode, false) : stats_get_max(p_snode->stats);
+}
+
+
+sensor_value_t datamgr_get_variance(sensor_id_t sensor_id)
+{
+    return stats_get_variance(sensor_stats(sensor_id));
+}
+
+
+sensor_value_t datamgr_get_ewma(sensor_id_t sensor_id)
+{
+    return stats_get_ewma(sensor_stats(sensor_id));
+}
+
+
+sensor_value_t datamgr_get_quantile(sensor_id_t sensor_id, double q)
+{
+    return stats_get_quantile(sensor_stats(sensor_id), q);
+}
+
+
+/*
+ * Gets the 'q' quantile of the readings of all sensors in a certain room ID, their sketches are merged
+ * Returns NAN if no sensor of the room has quantiles enabled or got a reading
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+sensor_value_t datamgr_get_room_quantile(uint16_t room_id, double q)
+{
+    room_node_data_t *p_room = room_lookup(room_id);
+    qsketch_t *sketch = NULL;
+    ERROR_HANDLER(p_room == NULL, "error");
+    ERROR_HANDLER(qsketch_create(&sketch) != STATS_SUCCESS, "error");
+    for (int i = 0; i < p_room->sensor_cnt; i++){
+        const qsketch_t *sensor_sketch = stats_sketch(sensor_lookup(p_room->sensor_ids[i])->stats);
+        if (sensor_sketch != NULL)
+            ERROR_HANDLER(qsketch_merge(sketch, sensor_sketch) != STATS_SUCCESS, "error");
+    }
+    sensor_value_t quantile = qsketch_quantile(sketch, q);
+    qsketch_free(&sketch);
+    return quantile;
 }
    
 
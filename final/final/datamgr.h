@@ -10,9 +10,34 @@
 
 
 #ifndef RUN_AVG_LENGTH
-  #define RUN_AVG_LENGTH 5
+  #define RUN_AVG_LENGTH 5 // default running average window, rooms can override it in the room_config.map
 #endif
 
+#define DATAMGR_MAX_WINDOW UINT16_MAX // largest running average window
+
+#ifndef DATAMGR_WINDOW_SEC
+  #define DATAMGR_WINDOW_SEC 0 // default time window in seconds, 0 averages the last RUN_AVG_LENGTH readings instead
+#endif
+
+#define DATAMGR_MAX_WINDOW_SEC (7 * 24 * 3600) // longest time window
+
+#ifndef DATAMGR_WINDOW_BUCKETS
+  #define DATAMGR_WINDOW_BUCKETS 64 // buckets of a time window at most, longer windows get wider buckets
+#endif
+
+#ifndef DATAMGR_ALERT_HYSTERESIS
+  #define DATAMGR_ALERT_HYSTERESIS 0.5 // degrees the running average has to fall back inside a threshold to end an alert
+#endif
+
+#ifndef DATAMGR_ALERT_DWELL
+  #define DATAMGR_ALERT_DWELL 0 // seconds a new alert state has to last before it is logged
+#endif
+
+#ifndef DATAMGR_ALERT_SUMMARY
+  #define DATAMGR_ALERT_SUMMARY 60 // seconds between the summaries of a lasting alert, 0 for none
+#endif
+
+// default thresholds, rooms can override them in the room_config.map
 #ifndef SET_MAX_TEMP
   #error SET_MAX_TEMP not set
 #endif
@@ -21,6 +46,22 @@
   #error SET_MIN_TEMP not set
 #endif
 
+#ifndef DATAMGR_STATS
+  #define DATAMGR_STATS 0 // STATS_* statistics kept per sensor unless the room_config.map enables others, none by default
+#endif
+
+#ifndef DATAMGR_EWMA_ALPHA
+  #define DATAMGR_EWMA_ALPHA 0.1 // weight of a new reading in the EWMA
+#endif
+
+#ifndef DATAMGR_ROOM_RESUM
+  #define DATAMGR_ROOM_RESUM 65536 // readings of a room after which its sum of averages is recomputed
+#endif
+
+#ifndef DATAMGR_CONFIG_CHECK_MS
+  #define DATAMGR_CONFIG_CHECK_MS 1000 // how often a watched room_config.map is checked for changes
+#endif
+
 /*
  * Use ERROR_HANDLER() for handling memory allocation problems, invalid sensor IDs, non-existing files, etc.
  */
@@ -39,17 +80,58 @@ void datamgr_parse_sensor_files(FILE * fp_sensor_map, FILE * fp_sensor_data);
 
 
 /*
-* Reads continiously all data from the shared buffer data structure, parse the room_id's
+ * Reads the optional room settings before the sensor map is parsed, one line per room:
+ *   <room id> key=value ...    settings of one room
+ *   default key=value ...      settings of every room without its own value
+ * Keys: min=<degrees>         too cold below this running average (SET_MIN_TEMP)
+ *       max=<degrees>         too hot above this running average (SET_MAX_TEMP)
+ *       window=<readings>     running average window (1 .. DATAMGR_MAX_WINDOW)
+ *       window_sec=<seconds>  running average over the readings of the last seconds by their timestamp, instead of
+ *                             the last 'window' readings, 0 to switch back (DATAMGR_WINDOW_SEC, at most DATAMGR_MAX_WINDOW_SEC)
+ *                             The window moves in buckets of window_sec / DATAMGR_WINDOW_BUCKETS seconds (rounded up),
+ *                             readings older than the window are left out of the average
+ *       hysteresis=<degrees>  an alert ends this far back inside the threshold (DATAMGR_ALERT_HYSTERESIS)
+ *       dwell=<seconds>       a new alert state is logged once it lasted this long (DATAMGR_ALERT_DWELL)
+ *       summary=<seconds>     period of the summary of a lasting alert, 0 for none (DATAMGR_ALERT_SUMMARY)
+ *       stats=<list>          statistics per sensor: minmax,variance,ewma,quantiles, all or none (DATAMGR_STATS)
+ *       ewma=<weight>         weight of a new reading in the EWMA, 0 < weight <= 1 (DATAMGR_EWMA_ALPHA)
+ * Invalid lines are logged and skipped, as are thresholds of a room with min >= max
+ * Returns 0 when every line was valid and -1 otherwise
+ */
+int datamgr_load_room_config(FILE * fp_room_config);
+
+
+/*
+ * Loads the room settings from the file 'path' like datamgr_load_room_config, a missing file is no error
+ * While datamgr_parse_sensor_data runs the file is checked every DATAMGR_CONFIG_CHECK_MS, a changed file replaces
+ * all room settings and is applied to the registered sensors. A sensor whose window changes starts a new running average
+ */
+int datamgr_watch_room_config(const char * path);
+
+
+/*
+* Reads continiously all data from the shared buffer data structure through 'reader', parse the room_id's
 * and calculate the running avarage for all sensor ids
-* When *buffer becomes NULL the method finishes. This method will NOT automatically free all used memory
-*/
-//void datamgr_parse_sensor_data(FILE * fp_sensor_map, sbuffer_t ** buffer);
-
-
-/*
-* We prefer a solution based on 1 sbuffer, but if you can't implement such a solution and you use 2 sbuffers. You should use the following function header in that situation:
-*/
-void datamgr_parse_sensor_data(FILE * fp_sensor_map, sbuffer_t ** buffer1, sbuffer_t ** buffer2);
+* Crossing the max or min threshold of the room is logged once per alert, with periodic summaries while it lasts
+* The storage manager reads the same buffer through its own reader, nothing is copied for it
+* 'fp_sensor_map' is NULL when datamgr_load_sensor_map loaded the room_sensor.map already
+* When no more data arrives the method finishes. This method will NOT automatically free all used memory
+*/
+void datamgr_parse_sensor_data(FILE * fp_sensor_map, sbuffer_reader_t * reader);
+
+
+/*
+ * Reads the room_sensor.map before datamgr_parse_sensor_data runs, so other threads can use datamgr_sensor_known
+ * Load the room settings first, they are applied to the sensors as they are registered
+ */
+void datamgr_load_sensor_map(FILE * fp_sensor_map);
+
+
+/*
+ * Returns 1 if 'sensor_id' occurs in the room_sensor.map, 0 otherwise
+ * Safe to call from other threads once the map is loaded, the sensors don't change after that
+ */
+int datamgr_sensor_known(sensor_id_t sensor_id);
 
 /*
  * This method should be called to clean up the datamgr, and to free all used memory. 
@@ -65,7 +147,8 @@ uint16_t datamgr_get_room_id(sensor_id_t sensor_id);
 
 
 /*
- * Gets the running AVG of a certain senor ID (if less then RUN_AVG_LENGTH measurements are recorded the avg is 0)
+ * Gets the running AVG of a certain senor ID (if less then a window of measurements are recorded it averages the ones received, 0 if none)
+ * With a time window it is the average of the readings in the window of the last reading
  * Use ERROR_HANDLER() if sensor_id is invalid 
  */
 sensor_value_t datamgr_get_avg(sensor_id_t sensor_id);
@@ -82,6 +165,77 @@ time_t datamgr_get_last_modified(sensor_id_t sensor_id);
  *  Return the total amount of unique sensor ID's recorded by the datamgr
  */
 int datamgr_get_total_sensors();
+
+
+/*
+ * The room getters run in O(1), the aggregates are updated with every reading
+ * Gets the mean of the running averages of the sensors in a certain room ID that got readings, 0 if none did
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+sensor_value_t datamgr_get_room_avg(uint16_t room_id);
+
+
+/*
+ * Gets the lowest reading of the sensors in a certain room ID, 0 before the first reading
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+sensor_value_t datamgr_get_room_min(uint16_t room_id);
+
+
+/*
+ * Gets the highest reading of the sensors in a certain room ID, 0 before the first reading
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+sensor_value_t datamgr_get_room_max(uint16_t room_id);
+
+
+/*
+ * Returns the time of the last reading in a certain room ID
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+time_t datamgr_get_room_last_modified(uint16_t room_id);
+
+
+/*
+ * Returns the number of sensors in a certain room ID that got readings
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+int datamgr_get_room_active_sensors(uint16_t room_id);
+
+
+/*
+ *  Return the total amount of unique room ID's in the room_sensor.map
+ */
+int datamgr_get_total_rooms();
+
+
+/*
+ * Statistics of a certain sensor ID, kept in amortized O(1) per reading when the stats= setting of its room enables them
+ * datamgr_get_min / datamgr_get_max : over the running average window, the last 'window' readings or with window_sec
+ *                                     the readings in the time window of the last reading (minmax)
+ * datamgr_get_variance : sample variance of all readings (variance)
+ * datamgr_get_ewma : exponentially weighted moving average (ewma)
+ * datamgr_get_quantile : 'q' quantile of all readings (0 <= q <= 1) within STATS_SKETCH_ACCURACY relative error (quantiles)
+ * They return NAN if the statistic isn't enabled or there is no reading yet
+ * Use ERROR_HANDLER() if sensor_id is invalid
+ */
+sensor_value_t datamgr_get_min(sensor_id_t sensor_id);
+
+sensor_value_t datamgr_get_max(sensor_id_t sensor_id);
+
+sensor_value_t datamgr_get_variance(sensor_id_t sensor_id);
+
+sensor_value_t datamgr_get_ewma(sensor_id_t sensor_id);
+
+sensor_value_t datamgr_get_quantile(sensor_id_t sensor_id, double q);
+
+
+/*
+ * Gets the 'q' quantile of the readings of all sensors in a certain room ID by merging their quantile sketches
+ * Returns NAN if no sensor of the room has quantiles enabled or got a reading
+ * Use ERROR_HANDLER() if room_id is invalid
+ */
+sensor_value_t datamgr_get_room_quantile(uint16_t room_id, double q);
    
 
 
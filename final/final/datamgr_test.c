@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "datamgr.h"
+
+static int failures = 0;
+
+#define CHECK_AVG(id, expected) do { \
+                                  sensor_value_t avg = datamgr_get_avg(id); \
+                                  if (fabs(avg - (expected)) > 1e-9) { \
+                                    printf("FAIL %s:%d sensor %d average %g, expected %g\n", __FILE__, __LINE__, (id), avg, (double)(expected)); \
+                                    failures++; \
+                                  } \
+                                } while(0)
+
+// writes 'count' readings to a temporary file in the sensor_data format
+static FILE *data_file(const sensor_data_t *data, size_t count)
+{
+  FILE *fp = tmpfile();
+  ERROR_HANDLER(fp == NULL, "tmpfile");
+  for (size_t i = 0; i < count; i++)
+  {
+    fwrite(&data[i].id, sizeof(data[i].id), 1, fp);
+    fwrite(&data[i].value, sizeof(data[i].value), 1, fp);
+    fwrite(&data[i].ts, sizeof(data[i].ts), 1, fp);
+  }
+  rewind(fp);
+  return fp;
+}
+
+static FILE *text_file(const char *text)
+{
+  FILE *fp = tmpfile();
+  ERROR_HANDLER(fp == NULL, "tmpfile");
+  fputs(text, fp);
+  rewind(fp);
+  return fp;
+}
+
+/*
+ * Time windows of 640 seconds have buckets of 10 seconds, readings from the first seconds of 1970 and before it
+ * must land in their own buckets of the ring
+ */
+static void test_time_window_near_epoch()
+{
+  const sensor_data_t data[] = {
+    {1, 10, 0}, {1, 20, 1},
+    {2, 100, -1000}, {2, 10, -5}, {2, 20, 5},
+    {3, 30, -1}, {3, 50, 629},
+  };
+  FILE *config = text_file("default window_sec=640\n");
+  FILE *map = text_file("1 1\n1 2\n2 3\n");
+  FILE *readings = data_file(data, sizeof(data) / sizeof(data[0]));
+  datamgr_load_room_config(config);
+  datamgr_parse_sensor_files(map, readings);
+  CHECK_AVG(1, 15);
+  // the reading of -1000 is older than the window
+  CHECK_AVG(2, 15);
+  CHECK_AVG(3, 40);
+  datamgr_free();
+  fclose(config);
+  fclose(map);
+  fclose(readings);
+}
+
+/*
+ * With window_sec the min and max cover the same readings as the time window average, not the last 'window' readings
+ */
+static void test_time_window_minmax()
+{
+  const sensor_data_t data[] = {
+    {1, 5, 1000}, {1, 30, 1010}, {1, 12, 1100}, {1, 18, 1700},
+  };
+  FILE *config = text_file("default window=3 window_sec=640 stats=minmax\n");
+  FILE *map = text_file("1 1\n");
+  FILE *readings = data_file(data, sizeof(data) / sizeof(data[0]));
+  datamgr_load_room_config(config);
+  datamgr_parse_sensor_files(map, readings);
+  // the readings of 1000 and 1010 left the window of 1700, the last 3 readings would give 12 and 30
+  if (datamgr_get_min(1) != 12 || datamgr_get_max(1) != 18)
+  {
+    printf("FAIL %s:%d min %g max %g, expected 12 and 18\n", __FILE__, __LINE__, datamgr_get_min(1), datamgr_get_max(1));
+    failures++;
+  }
+  CHECK_AVG(1, 15);
+  datamgr_free();
+  fclose(config);
+  fclose(map);
+  fclose(readings);
+}
+
+int main(void)
+{
+  test_time_window_near_epoch();
+  test_time_window_minmax();
+  if (failures > 0)
+  {
+    printf("%d checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("all checks passed\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include "logger.h"
+
+#define CACHE_LINE 64
+#define LOGGER_MSG_SIZE (LOGGER_RECORD_SIZE - sizeof(struct timespec) - sizeof(uint32_t))
+#define LOGGER_BATCH 64 // lines per writev
+#define LOGGER_LINE_SIZE (LOGGER_MSG_SIZE + 48) // "<sequence> <time> " in front of the event
+
+typedef struct logger_record {
+  struct timespec ts; // CLOCK_REALTIME when the event was queued
+  uint32_t len;
+  char msg[LOGGER_MSG_SIZE];
+} logger_record_t;
+
+/*
+ * Single producer / single consumer ring, the owning thread moves 'head' and the logger thread 'tail'
+ */
+typedef struct logger_ring {
+  _Alignas(CACHE_LINE) atomic_size_t head;
+  atomic_uint_fast64_t dropped; // events lost to a full ring
+  _Alignas(CACHE_LINE) atomic_size_t tail;
+  uint64_t dropped_reported; // logger thread only
+  struct logger_ring * next;
+  logger_record_t records[LOGGER_RING_RECORDS];
+} logger_ring_t;
+
+static _Atomic(logger_ring_t *) logger_rings = NULL; // every ring ever registered, rings are only freed by logger_close
+static _Thread_local logger_ring_t * logger_own_ring = NULL;
+static atomic_int logger_running = 0;
+static atomic_int logger_stop = 0;
+static pthread_t logger_tid;
+static int logger_fd = -1;
+static uint64_t logger_seq = 0;
+static char logger_lines[LOGGER_BATCH][LOGGER_LINE_SIZE];
+
+
+// the ring of the calling thread, registered on first use, NULL if it can't be allocated
+static logger_ring_t * logger_ring()
+{
+  if (logger_own_ring != NULL) return logger_own_ring;
+  logger_ring_t * ring = aligned_alloc(CACHE_LINE, sizeof(logger_ring_t));
+  if (ring == NULL) return NULL;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->dropped, 0);
+  ring->dropped_reported = 0;
+  ring->next = atomic_load_explicit(&logger_rings, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&logger_rings, &ring->next, ring, memory_order_release, memory_order_relaxed));
+  logger_own_ring = ring;
+  return ring;
+}
+
+void log_event(const char * event)
+{
+  if (!atomic_load_explicit(&logger_running, memory_order_acquire))
+  {
+    fputs(event, stderr);
+    return;
+  }
+  logger_ring_t * ring = logger_ring();
+  if (ring == NULL) return;
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOGGER_RING_RECORDS)
+  {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  logger_record_t * record = &ring->records[head & (LOGGER_RING_RECORDS - 1)];
+  clock_gettime(CLOCK_REALTIME, &record->ts);
+  record->len = strnlen(event, LOGGER_MSG_SIZE);
+  memcpy(record->msg, event, record->len);
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// writes all 'count' buffers, following up on short writes
+static void logger_writev(struct iovec * iov, int count)
+{
+  while (count > 0)
+  {
+    ssize_t n = writev(logger_fd, iov, count);
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+      perror("Write log file error");
+      return;
+    }
+    while (count > 0 && (size_t)n >= iov->iov_len)
+    {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+// formats one line in front of the next event or drop note, the event gets a newline if it has none
+static size_t logger_format(char * line, uint64_t seq, time_t ts, const char * msg, size_t len)
+{
+  size_t n = snprintf(line, LOGGER_LINE_SIZE, "%" PRIu64 " %ld ", seq, (long)ts);
+  memcpy(line + n, msg, len);
+  n += len;
+  if (len == 0 || msg[len - 1] != '\n') line[n++] = '\n';
+  return n;
+}
+
+/*
+ * Moves up to LOGGER_BATCH events from the rings to the log file, merged in timestamp order
+ * Returns the number of lines written
+ */
+static int logger_drain()
+{
+  struct iovec iov[LOGGER_BATCH];
+  int count = 0;
+  logger_ring_t * rings = atomic_load_explicit(&logger_rings, memory_order_acquire);
+  while (count < LOGGER_BATCH)
+  {
+    logger_ring_t * oldest = NULL;
+    const logger_record_t * oldest_record = NULL;
+    for (logger_ring_t * ring = rings; ring != NULL && count < LOGGER_BATCH; ring = ring->next)
+    {
+      uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+      if (dropped != ring->dropped_reported)
+      {
+        char note[64];
+        size_t len = snprintf(note, sizeof(note), "%" PRIu64 " log events dropped, ring full", dropped - ring->dropped_reported);
+        iov[count].iov_base = logger_lines[count];
+        iov[count].iov_len = logger_format(logger_lines[count], logger_seq++, time(NULL), note, len);
+        count++;
+        ring->dropped_reported = dropped;
+      }
+      size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+      if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) continue;
+      const logger_record_t * record = &ring->records[tail & (LOGGER_RING_RECORDS - 1)];
+      if (oldest_record == NULL || record->ts.tv_sec < oldest_record->ts.tv_sec ||
+          (record->ts.tv_sec == oldest_record->ts.tv_sec && record->ts.tv_nsec < oldest_record->ts.tv_nsec))
+      {
+        oldest = ring;
+        oldest_record = record;
+      }
+    }
+    if (oldest == NULL || count == LOGGER_BATCH) break;
+    iov[count].iov_base = logger_lines[count];
+    iov[count].iov_len = logger_format(logger_lines[count], logger_seq++, oldest_record->ts.tv_sec, oldest_record->msg, oldest_record->len);
+    count++;
+    atomic_store_explicit(&oldest->tail, atomic_load_explicit(&oldest->tail, memory_order_relaxed) + 1, memory_order_release);
+  }
+  if (count > 0) logger_writev(iov, count);
+  return count;
+}
+
+static void * logger_run(void * arg)
+{
+  struct timespec idle = {0, LOGGER_IDLE_MS * 1000000L};
+  while (!atomic_load_explicit(&logger_stop, memory_order_acquire))
+  {
+    if (logger_drain() == 0) nanosleep(&idle, NULL);
+  }
+  // events queued before the stop
+  while (logger_drain() > 0);
+  return NULL;
+}
+
+int logger_init(const char * path)
+{
+  if (atomic_load(&logger_running)) return LOGGER_FAILURE;
+  logger_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+  if (logger_fd < 0) return LOGGER_FAILURE;
+  atomic_store(&logger_stop, 0);
+  if (pthread_create(&logger_tid, NULL, logger_run, NULL) != 0)
+  {
+    close(logger_fd);
+    logger_fd = -1;
+    return LOGGER_FAILURE;
+  }
+  atomic_store_explicit(&logger_running, 1, memory_order_release);
+  return LOGGER_SUCCESS;
+}
+
+void logger_close(void)
+{
+  char line[LOGGER_LINE_SIZE];
+  const char * msg = "Logger terminated...\n";
+  if (!atomic_load(&logger_running)) return;
+  atomic_store_explicit(&logger_running, 0, memory_order_release);
+  atomic_store_explicit(&logger_stop, 1, memory_order_release);
+  pthread_join(logger_tid, NULL);
+  struct iovec iov = {line, logger_format(line, logger_seq++, time(NULL), msg, strlen(msg))};
+  logger_writev(&iov, 1);
+  close(logger_fd);
+  logger_fd = -1;
+  // no thread logs to a ring anymore
+  logger_ring_t * ring = atomic_exchange(&logger_rings, NULL);
+  while (ring != NULL)
+  {
+    logger_ring_t * next = ring->next;
+    free(ring);
+    ring = next;
+  }
+  logger_own_ring = NULL;
+}
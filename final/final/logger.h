@@ -0,0 +1,44 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#define LOGGER_FAILURE -1
+#define LOGGER_SUCCESS 0
+
+#ifndef LOGGER_RING_RECORDS
+  #define LOGGER_RING_RECORDS 256 // records in the ring of every logging thread, a power of two
+#endif
+
+#define LOGGER_RECORD_SIZE 256 // bytes of one record, longer events are cut off
+
+#ifndef LOGGER_IDLE_MS
+  #define LOGGER_IDLE_MS 10 // the logger thread polls the rings this often when they are empty
+#endif
+
+/*
+ * Every thread that logs gets its own single producer ring of fixed-size records, registered on its first event
+ * One logger thread drains all rings in timestamp order, numbers the events and writes them with writev as
+ * "<sequence> <time> <event>" lines. A full ring drops the event and counts it, logging never blocks the caller
+ */
+
+
+/*
+ * Creates (truncates) the log file 'path' and starts the logger thread
+ * Returns LOGGER_SUCCESS on success and LOGGER_FAILURE if an error occured
+ */
+int logger_init(const char * path);
+
+
+/*
+ * Queues 'event', a line of text, on the ring of the calling thread
+ * Without a running logger the event goes to stderr
+ */
+void log_event(const char * event);
+
+
+/*
+ * Writes every queued event, stops the logger thread and closes the log file
+ */
+void logger_close(void);
+
+
+#endif  //_LOGGER_H_
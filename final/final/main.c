@@ -4,19 +4,15 @@
 #include <limits.h>
 #include <pthread.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <sys/stat.h>
 #include "connmgr.h"
 #include "datamgr.h"
 #include "sbuffer.h"
 #include "sensor_db.h"
+#include "storage.h"
+#include "logger.h"
 
 #define LOG_MAX_LEN 1024
 void gateway_help(void);
-void create_fifo(void);
-void log_write_process(void);
-void write_fifo(const char* log_event);
 void *connmgr_start(void *arg);
 void *datamgr_start(void *arg);
 void *stgmgr_start(void *arg);
@@ -24,49 +20,72 @@ void *stgmgr_start(void *arg);
 int is_gateway_close();
 void gateway_closed();
 
-const char* fifo_name = "logFifo";
 const char* log_file_name = "gateway.log";
 const char* room_map = "room_sensor.map";
+const char* room_config = "room_config.map";
 const char* terminated_msg = "Sensor gateway terminated...\n";
-FILE *fifo_write_fd = NULL;
 
 
-sbuffer_t *connmgr_to_datamgr, *datamgr_to_stgmgr;
+// one buffer filled by the connmgr, read once by the datamgr and once by the storage manager
+sbuffer_t *shared_buffer;
+sbuffer_reader_t *datamgr_reader, *stgmgr_reader;
+
+// storage sink of the storage manager, "<sink>[:<target>]" as described by storage_valid_spec
+const char* storage_spec = "sqlite";
+char sqlite_spec[64];
 
 int gateway_run = 1;
+// the room_sensor.map is loaded before the threads start, the storage manager only stores its sensors
+int room_map_loaded = 0;
 pthread_mutex_t gateway_mutex;
 int main(int argc, char *argv[])
 {
-	if (argc != 2){
+	if (argc < 2){
 		gateway_help();
 		exit(EXIT_FAILURE);
 	}
+	// options follow the port number
+	for (int i = 2; i < argc; i++){
+		db_profile_t profile;
+		if (strcmp(argv[i], "-p") == 0 && i + 1 < argc && db_profile_from_name(argv[i + 1], &profile) == 0){
+			// short for the sqlite sink with this profile
+			snprintf(sqlite_spec, sizeof(sqlite_spec), "sqlite:%s", argv[++i]);
+			storage_spec = sqlite_spec;
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && storage_valid_spec(argv[i + 1])){
+			storage_spec = argv[++i];
+		} else{
+			gateway_help();
+			exit(EXIT_FAILURE);
+		}
+	}
 	printf("Main process %d is running...\n", getpid());
 	int port = atoi(argv[1]);
-	pid_t log_pid;
-	log_pid = fork();
-	if (log_pid < 0){
-		printf("fork log process failure!\n");
-		exit(1);
-	} else if(log_pid == 0){
-		log_write_process();
-	}
-
-	create_fifo();
-	fifo_write_fd = fopen(fifo_name, "w");
-	if (fifo_write_fd == NULL){
-		perror("Open fifo error\n");
+	if (logger_init(log_file_name) != LOGGER_SUCCESS){
+		perror("Open log file error");
 		exit(1);
 	}
 
-	if (sbuffer_init(&connmgr_to_datamgr) != SBUFFER_SUCCESS ||
-		sbuffer_init(&datamgr_to_stgmgr) != SBUFFER_SUCCESS){
-		write_fifo("Create share buffer failure!\n");
-		fclose(fifo_write_fd);
+	// the readers are registered before the connmgr starts, so both of them see every reading
+	if (sbuffer_init_backend(&shared_buffer, SBUFFER_MULTI, SBUFFER_RING_CAPACITY) != SBUFFER_SUCCESS ||
+		sbuffer_reader_register(shared_buffer, &datamgr_reader) != SBUFFER_SUCCESS ||
+		sbuffer_reader_register(shared_buffer, &stgmgr_reader) != SBUFFER_SUCCESS){
+		log_event("Create share buffer failure!\n");
+		logger_close();
 		gateway_run = 0;
 		exit(EXIT_FAILURE);
 	}
 
+	// the room configuration is optional, all rooms use the defaults without it, changes are picked up while running
+	datamgr_watch_room_config(room_config);
+	FILE *room_fd = fopen(room_map, "r");
+	if (room_fd == NULL){
+		perror("Open room_sensor.map file error");
+	} else{
+		datamgr_load_sensor_map(room_fd);
+		fclose(room_fd);
+		room_map_loaded = 1;
+	}
+
 	pthread_t connmgr_tid, datamgr_tid, stgmgr_tid;
 	pthread_create(&connmgr_tid, NULL, &connmgr_start, &port);
 	pthread_create(&datamgr_tid, NULL, &datamgr_start, NULL);
@@ -74,15 +93,16 @@ int main(int argc, char *argv[])
 	pthread_join(connmgr_tid, NULL);
 	pthread_join(datamgr_tid, NULL);
 	pthread_join(stgmgr_tid, NULL);
+	// the storage manager looks up sensors until it finishes
+	datamgr_free();
 	
-	if (sbuffer_free(&connmgr_to_datamgr) != SBUFFER_SUCCESS ||
-		sbuffer_free(&datamgr_to_stgmgr) != SBUFFER_SUCCESS){
-		write_fifo("Free share buffer failure!\n");
+	if (sbuffer_free(&shared_buffer) != SBUFFER_SUCCESS){
+		log_event("Free share buffer failure!\n");
 	}
 	
-	write_fifo(terminated_msg);
-	log_pid = wait(NULL);
-	fclose(fifo_write_fd);
+	log_event(terminated_msg);
+	// every thread that logs has finished
+	logger_close();
 	printf("Main process %d terminated...\n", getpid());
 	return 0;
 }
@@ -91,113 +111,57 @@ void gateway_help(void)
 {
 	printf("Use this program with 1 command line options: \n");
 	printf("\t%-15s : TCP server port number\n", "\'server port\'");
-}
-
-void create_fifo()
-{
-	int res = -1;
-	if (access(fifo_name, F_OK) < 0){
-		res = mkfifo(fifo_name, 0777);
-		if (res < 0){
-			perror("Create FIFO error\n");
-			exit(1);
-		}
-	}
-}
-
-void log_write_process()
-{
-	int sqe_num = 0;
-	char read_buf[LOG_MAX_LEN];
-	FILE *log_fd, *fifo_read_fd;
-	printf("Log process %d is running...\n", getpid());
-
-	
-	create_fifo();
-	fifo_read_fd = fopen(fifo_name, "r");
-	if (fifo_read_fd == NULL){
-		perror("Open fifo error\n");
-		exit(EXIT_FAILURE);
-	}
-
-	log_fd = fopen(log_file_name, "w");
-	if (fifo_read_fd == NULL){
-		perror("Open log file error\n");
-		fclose(fifo_read_fd);
-		exit(EXIT_FAILURE);
-	}
-	while (1){
-		if (fgets(read_buf, LOG_MAX_LEN, fifo_read_fd) != NULL){
-			fprintf(log_fd, "%d %ld %s", sqe_num, time(NULL), read_buf);
-			//fprintf(stdout, "%d %s", sqe_num, read_buf);
-			sqe_num++;
-		}
-		if (strcmp(read_buf, terminated_msg) == 0)
-			break;
-	}
-	fprintf(log_fd, "%d %ld Log process terminated...\n", sqe_num++, time(NULL));
-	fclose(fifo_read_fd);
-	fclose(log_fd);
-	printf("Log process %d terminated...\n", getpid());
-	exit(EXIT_SUCCESS);
-}
-
-void write_fifo(const char* log_event)
-{
-	char write_buf[LOG_MAX_LEN];
-	memcpy(write_buf, log_event, LOG_MAX_LEN);
-	//fprintf(stdout, "%s", write_buf);
-	if (fputs(write_buf, fifo_write_fd) == EOF){
-		perror("Write fifo error");
-	}
-	fflush(fifo_write_fd);
-
+	printf("Optional after the port number: \n");
+	printf("\t%-15s : storage sink, one of\n", "-s \'sink\'");
+	printf("\t%-15s   sqlite[:profile] the database %s (default)\n", "", TO_STRING(DB_NAME));
+	printf("\t%-15s   binlog[:file]    append to a file in the sensor_data format (default %s)\n", "", STORAGE_BINLOG_FILE);
+	printf("\t%-15s   tsdb:directory   time-series segment store\n", "");
+	printf("\t%-15s   null             drop the readings\n", "");
+	printf("\t%-15s : database durability profile, safe (default), balanced or fast, same as -s sqlite:profile\n", "-p \'profile\'");
 }
 
 void *connmgr_start(void *arg)
 {
 	int *server_port = (int *)arg;
-	write_fifo("connection manager run...\n");
-	connmgr_listen(*server_port, connmgr_to_datamgr);
+	log_event("connection manager run...\n");
+	connmgr_listen(*server_port, shared_buffer);
 	connmgr_free();
-	write_fifo("connection manager terminated...\n");
+	// no more readings, let the consumers drain the buffer and stop
+	sbuffer_close(shared_buffer);
+	log_event("connection manager terminated...\n");
 	gateway_closed();
 	pthread_exit(NULL);
 }
 
 void *datamgr_start(void *arg)
 {
-	FILE *room_fd = fopen(room_map, "r");
-	write_fifo("data manager run...\n");
-	if (room_fd == NULL){
-		perror("Open room_sensor.map file error");
+	log_event("data manager run...\n");
+	if (!room_map_loaded){
+		sbuffer_reader_unregister(&datamgr_reader);
 		gateway_run = 0;
 		pthread_exit(NULL);
 	}
-	datamgr_parse_sensor_data(room_fd, &connmgr_to_datamgr, &datamgr_to_stgmgr);
-	datamgr_free();
-	fclose(room_fd);
-	write_fifo("data manager terminated...\n");
+	datamgr_parse_sensor_data(NULL, datamgr_reader);
+	sbuffer_reader_unregister(&datamgr_reader);
+	log_event("data manager terminated...\n");
 	gateway_closed();
 	pthread_exit(NULL);
 }
 
 void *stgmgr_start(void *arg)
 {
-	DBCONN *conn = NULL;
-	int attempts = 3;
-	write_fifo("storage manager run...\n");
-	for (int i = 0; i < attempts; i++){
-		conn = init_connection(1);
-		if (conn != NULL)
-			break;
-		else
-			sleep(3);
-	}
+	storage_sink_t *sink = NULL;
+	log_event("storage manager run...\n");
+	if (storage_open(&sink, storage_spec) != STORAGE_SUCCESS)
+		log_event("Open storage sink failure!\n");
+	// readings of sensors that are not in the room_sensor.map are not stored, nothing is without the map
+	storage_set_filter(sink, datamgr_sensor_known);
 
-	storagemgr_parse_sensor_data(conn, &datamgr_to_stgmgr);
-	disconnect(conn);
-	write_fifo("storage manager terminated...\n");
+	storage_parse_sensor_data(sink, stgmgr_reader);
+	// don't hold the connmgr back if the storage manager stops early
+	sbuffer_reader_unregister(&stgmgr_reader);
+	storage_close(&sink);
+	log_event("storage manager terminated...\n");
 	gateway_closed();
 	pthread_exit(NULL);
 }
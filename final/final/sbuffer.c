@@ -1,10 +1,16 @@
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <pthread.h>
-#include <sys/time.h>
+#include <time.h>
 #include "sbuffer.h"
 
+#define CACHE_LINE 64
+
 
 /*
  * All data that can be stored in the sbuffer should be encapsulated in a
@@ -19,22 +25,121 @@ typedef struct sbuffer_node {
   sbuffer_data_t element;
 } sbuffer_node_t;
 
+/*
+ * Slot of the ring, padded to a cache line so neighbouring slots don't false share
+ * 'seq' == position : free for the producer claiming 'position'
+ * 'seq' == position + 1 : filled, ready for the consumer claiming 'position'
+ */
+typedef struct sbuffer_cell {
+  _Alignas(CACHE_LINE) atomic_size_t seq;
+  sbuffer_data_t element;
+} sbuffer_cell_t;
+
+typedef struct sbuffer_ring {
+  sbuffer_cell_t * cells;
+  size_t mask;
+  _Alignas(CACHE_LINE) atomic_size_t enqueue_pos;
+  _Alignas(CACHE_LINE) atomic_size_t dequeue_pos;
+  _Alignas(CACHE_LINE) atomic_int readers_waiting; // consumers sleeping on an empty ring
+  atomic_int writers_waiting; // producers sleeping on a full ring
+} sbuffer_ring_t;
+
+// cursor of one reader of a SBUFFER_MULTI buffer, on its own cache line
+struct sbuffer_reader {
+  _Alignas(CACHE_LINE) atomic_size_t pos; // position of the next reading to read
+  atomic_int active;
+  sbuffer_t * buffer;
+};
+
+typedef struct sbuffer_multi {
+  sbuffer_data_t * slots;
+  size_t mask;
+  size_t min_pos; // producer side lower bound of the slowest reader, protected by write_mutex
+  pthread_mutex_t write_mutex; // serializes the producers
+  _Alignas(CACHE_LINE) atomic_size_t write_pos; // readings published so far
+  _Alignas(CACHE_LINE) atomic_int readers_waiting; // readers sleeping on an empty buffer
+  atomic_int writers_waiting; // producers sleeping until the slowest reader moves on
+  struct sbuffer_reader readers[SBUFFER_MAX_READERS];
+} sbuffer_multi_t;
+
 struct sbuffer {
+  sbuffer_backend_t backend;
   sbuffer_node_t * head;
   sbuffer_node_t * tail;
-  pthread_cond_t cond;
-  pthread_mutex_t mutex;
+  pthread_cond_t cond; // data available
+  pthread_cond_t not_full; // ring only : a slot was released
+  pthread_mutex_t mutex; // list : protects the list, ring : only used by the blocking slow path
+  atomic_int closed; // no more inserts, consumers stop once the buffer is drained
+  sbuffer_ring_t ring;
+  sbuffer_multi_t multi;
 };	
 
 
 int sbuffer_init(sbuffer_t ** buffer)
 {
-  *buffer = malloc(sizeof(sbuffer_t));
+  return sbuffer_init_backend(buffer, SBUFFER_LIST, 0);
+}
+
+
+int sbuffer_init_backend(sbuffer_t ** buffer, sbuffer_backend_t backend, size_t capacity)
+{
+  size_t size = 1;
+  *buffer = aligned_alloc(CACHE_LINE, (sizeof(sbuffer_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
   if (*buffer == NULL) return SBUFFER_FAILURE;
+  (*buffer)->backend = backend;
   (*buffer)->head = NULL;
   (*buffer)->tail = NULL;
+  (*buffer)->ring.cells = NULL;
+  (*buffer)->multi.slots = NULL;
+  atomic_init(&(*buffer)->closed, 0);
+  if (capacity == 0) capacity = SBUFFER_RING_CAPACITY;
+  while (size < capacity) size <<= 1;
+  if (backend == SBUFFER_MULTI)
+  {
+    sbuffer_multi_t * multi = &(*buffer)->multi;
+    multi->slots = malloc(size * sizeof(sbuffer_data_t));
+    if (multi->slots == NULL){
+      free(*buffer);
+      *buffer = NULL;
+      return SBUFFER_FAILURE;
+    }
+    multi->mask = size - 1;
+    multi->min_pos = 0;
+    pthread_mutex_init(&multi->write_mutex, NULL);
+    atomic_init(&multi->write_pos, 0);
+    atomic_init(&multi->readers_waiting, 0);
+    atomic_init(&multi->writers_waiting, 0);
+    for (int i = 0; i < SBUFFER_MAX_READERS; i++)
+    {
+      atomic_init(&multi->readers[i].pos, 0);
+      atomic_init(&multi->readers[i].active, 0);
+      multi->readers[i].buffer = *buffer;
+    }
+  }
+  if (backend == SBUFFER_RING)
+  {
+    (*buffer)->ring.cells = aligned_alloc(CACHE_LINE, size * sizeof(sbuffer_cell_t));
+    if ((*buffer)->ring.cells == NULL){
+      free(*buffer);
+      *buffer = NULL;
+      return SBUFFER_FAILURE;
+    }
+    for (size_t i = 0; i < size; i++)
+      atomic_init(&(*buffer)->ring.cells[i].seq, i);
+    (*buffer)->ring.mask = size - 1;
+    atomic_init(&(*buffer)->ring.enqueue_pos, 0);
+    atomic_init(&(*buffer)->ring.dequeue_pos, 0);
+    atomic_init(&(*buffer)->ring.readers_waiting, 0);
+    atomic_init(&(*buffer)->ring.writers_waiting, 0);
+  }
+  // timed waits are measured on the monotonic clock, wall clock jumps don't shorten or stretch them
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
   pthread_mutex_init(&(*buffer)->mutex, NULL);
-  pthread_cond_init(&(*buffer)->cond, NULL);
+  pthread_cond_init(&(*buffer)->cond, &attr);
+  pthread_cond_init(&(*buffer)->not_full, &attr);
+  pthread_condattr_destroy(&attr);
   return SBUFFER_SUCCESS; 
 }
 
@@ -53,33 +158,328 @@ int sbuffer_free(sbuffer_t ** buffer)
     (*buffer)->head = (*buffer)->head->next;
     free(dummy);
   }
+  free((*buffer)->ring.cells);
+  if ((*buffer)->backend == SBUFFER_MULTI)
+  {
+    free((*buffer)->multi.slots);
+    pthread_mutex_destroy(&(*buffer)->multi.write_mutex);
+  }
   pthread_mutex_destroy(&(*buffer)->mutex);
   pthread_cond_destroy(&(*buffer)->cond);
+  pthread_cond_destroy(&(*buffer)->not_full);
   free(*buffer);
   *buffer = NULL;
   return SBUFFER_SUCCESS;		
 }
 
-void calculate_outtime(struct timespec *outtime)
+int sbuffer_close(sbuffer_t * buffer)
+{
+  if (buffer == NULL) return SBUFFER_FAILURE;
+  pthread_mutex_lock(&buffer->mutex);
+  atomic_store(&buffer->closed, 1);
+  pthread_cond_broadcast(&buffer->cond);
+  pthread_cond_broadcast(&buffer->not_full);
+  pthread_mutex_unlock(&buffer->mutex);
+  return SBUFFER_SUCCESS;
+}
+
+// absolute deadline 'timeout_ms' from now on the monotonic clock, NULL means wait forever
+static struct timespec * calculate_outtime(struct timespec *outtime, int timeout_ms)
+{
+	if (timeout_ms < 0)
+		return NULL;
+	clock_gettime(CLOCK_MONOTONIC, outtime);
+	outtime->tv_sec += timeout_ms / 1000;
+	outtime->tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (outtime->tv_nsec >= 1000000000){
+		outtime->tv_sec++;
+		outtime->tv_nsec -= 1000000000;
+	}
+	return outtime;
+}
+
+// wait on 'cond' with 'buffer->mutex' held, returns ETIMEDOUT once 'outtime' passed
+static int sbuffer_wait(sbuffer_t * buffer, pthread_cond_t * cond, const struct timespec * outtime)
+{
+  if (outtime == NULL)
+    return pthread_cond_wait(cond, &buffer->mutex);
+  return pthread_cond_timedwait(cond, &buffer->mutex, outtime);
+}
+
+// lock-free fast path, returns 0 when the ring is full
+static int sbuffer_ring_try_push(sbuffer_ring_t * ring, const sensor_data_t * data)
+{
+  sbuffer_cell_t * cell;
+  size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+  while (1)
+  {
+    cell = &ring->cells[pos & ring->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+    if (dif == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0) // slot still holds data of the previous lap
+      return 0;
+    else
+      pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+  }
+  cell->element.data = *data;
+  atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+  return 1;
+}
+
+// lock-free fast path, returns 0 when the ring is empty
+static int sbuffer_ring_try_pop(sbuffer_ring_t * ring, sensor_data_t * data)
+{
+  sbuffer_cell_t * cell;
+  size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+  while (1)
+  {
+    cell = &ring->cells[pos & ring->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (dif == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0) // slot not filled yet
+      return 0;
+    else
+      pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+  }
+  *data = cell->element.data;
+  atomic_store_explicit(&cell->seq, pos + ring->mask + 1, memory_order_release);
+  return 1;
+}
+
+/*
+ * Wake the threads sleeping on 'cond', if any
+ * The fence pairs with the one in the slow paths: either the sleeper sees the new state or we see the sleeper
+ */
+static void sbuffer_ring_wake(sbuffer_t * buffer, pthread_cond_t * cond, atomic_int * waiting)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(waiting, memory_order_relaxed) > 0)
+  {
+    pthread_mutex_lock(&buffer->mutex);
+    pthread_cond_broadcast(cond);
+    pthread_mutex_unlock(&buffer->mutex);
+  }
+}
+
+// push one reading, only takes the mutex while the ring is full, returns 0 if the buffer got closed meanwhile
+static int sbuffer_ring_push(sbuffer_t * buffer, const sensor_data_t * data)
+{
+  sbuffer_ring_t * ring = &buffer->ring;
+  int pushed;
+  if (sbuffer_ring_try_push(ring, data)) return 1;
+  pthread_mutex_lock(&buffer->mutex);
+  atomic_fetch_add(&ring->writers_waiting, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  while (!(pushed = sbuffer_ring_try_push(ring, data)) && !atomic_load(&buffer->closed))
+  {
+    // readings of the current batch are not announced yet, consumers may be asleep
+    if (atomic_load_explicit(&ring->readers_waiting, memory_order_relaxed) > 0)
+      pthread_cond_broadcast(&buffer->cond);
+    pthread_cond_wait(&buffer->not_full, &buffer->mutex);
+  }
+  atomic_fetch_sub(&ring->writers_waiting, 1);
+  pthread_mutex_unlock(&buffer->mutex);
+  return pushed;
+}
+
+// wait up to 'timeout_ms' for the first reading, then take what is available up to 'max' without waiting
+static int sbuffer_ring_remove_batch(sbuffer_t * buffer, sensor_data_t * data, size_t max, size_t * count, int timeout_ms)
+{
+  sbuffer_ring_t * ring = &buffer->ring;
+  *count = 0;
+  if (!sbuffer_ring_try_pop(ring, data))
+  {
+    struct timespec outtime;
+    const struct timespec * deadline = calculate_outtime(&outtime, timeout_ms);
+    int ret = SBUFFER_SUCCESS;
+    pthread_mutex_lock(&buffer->mutex);
+    atomic_fetch_add(&ring->readers_waiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!sbuffer_ring_try_pop(ring, data))
+    {
+      // everything inserted before the close is visible once the close is
+      if (atomic_load(&buffer->closed) && !sbuffer_ring_try_pop(ring, data))
+      {
+        ret = SBUFFER_CLOSED;
+        break;
+      }
+      if (sbuffer_wait(buffer, &buffer->cond, deadline) == ETIMEDOUT &&
+          !sbuffer_ring_try_pop(ring, data))
+      {
+        ret = SBUFFER_NO_DATA;
+        break;
+      }
+    }
+    atomic_fetch_sub(&ring->readers_waiting, 1);
+    pthread_mutex_unlock(&buffer->mutex);
+    if (ret != SBUFFER_SUCCESS) return ret;
+  }
+  *count = 1;
+  while (*count < max && sbuffer_ring_try_pop(ring, &data[*count]))
+    (*count)++;
+  sbuffer_ring_wake(buffer, &buffer->not_full, &ring->writers_waiting);
+  return SBUFFER_SUCCESS;
+}
+
+// position of the slowest active reader, 'pos' when there is none
+static size_t sbuffer_multi_min_pos(sbuffer_multi_t * multi, size_t pos)
+{
+  size_t min = pos;
+  for (int i = 0; i < SBUFFER_MAX_READERS; i++)
+  {
+    if (!atomic_load_explicit(&multi->readers[i].active, memory_order_acquire)) continue;
+    size_t reader_pos = atomic_load_explicit(&multi->readers[i].pos, memory_order_acquire);
+    if (pos - reader_pos > pos - min) min = reader_pos;
+  }
+  return min;
+}
+
+// publish 'count' readings to every reader, waits while the slowest reader is a full ring behind
+static int sbuffer_multi_insert_batch(sbuffer_t * buffer, const sensor_data_t * data, size_t count)
+{
+  sbuffer_multi_t * multi = &buffer->multi;
+  size_t capacity = multi->mask + 1;
+  int ret = SBUFFER_SUCCESS;
+  pthread_mutex_lock(&multi->write_mutex);
+  size_t pos = atomic_load_explicit(&multi->write_pos, memory_order_relaxed);
+  for (size_t i = 0; i < count; i++)
+  {
+    if (pos - multi->min_pos >= capacity)
+    {
+      multi->min_pos = sbuffer_multi_min_pos(multi, pos);
+      if (pos - multi->min_pos >= capacity)
+      {
+        // let the readers catch up on what is written so far before going to sleep
+        atomic_store_explicit(&multi->write_pos, pos, memory_order_release);
+        pthread_mutex_lock(&buffer->mutex);
+        atomic_fetch_add(&multi->writers_waiting, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        while (pos - (multi->min_pos = sbuffer_multi_min_pos(multi, pos)) >= capacity &&
+               !atomic_load(&buffer->closed))
+        {
+          if (atomic_load_explicit(&multi->readers_waiting, memory_order_relaxed) > 0)
+            pthread_cond_broadcast(&buffer->cond);
+          pthread_cond_wait(&buffer->not_full, &buffer->mutex);
+        }
+        atomic_fetch_sub(&multi->writers_waiting, 1);
+        pthread_mutex_unlock(&buffer->mutex);
+        if (pos - multi->min_pos >= capacity) // closed while waiting
+        {
+          ret = SBUFFER_FAILURE;
+          break;
+        }
+      }
+    }
+    multi->slots[pos & multi->mask].data = data[i];
+    pos++;
+  }
+  atomic_store_explicit(&multi->write_pos, pos, memory_order_release);
+  pthread_mutex_unlock(&multi->write_mutex);
+  sbuffer_ring_wake(buffer, &buffer->cond, &multi->readers_waiting);
+  return ret;
+}
+
+int sbuffer_reader_register(sbuffer_t * buffer, sbuffer_reader_t ** reader)
+{
+  int ret = SBUFFER_FAILURE;
+  if (buffer == NULL || reader == NULL || buffer->backend != SBUFFER_MULTI) return SBUFFER_FAILURE;
+  sbuffer_multi_t * multi = &buffer->multi;
+  pthread_mutex_lock(&multi->write_mutex);
+  for (int i = 0; i < SBUFFER_MAX_READERS; i++)
+  {
+    if (atomic_load(&multi->readers[i].active)) continue;
+    atomic_store(&multi->readers[i].pos, atomic_load(&multi->write_pos));
+    atomic_store(&multi->readers[i].active, 1);
+    *reader = &multi->readers[i];
+    ret = SBUFFER_SUCCESS;
+    break;
+  }
+  pthread_mutex_unlock(&multi->write_mutex);
+  return ret;
+}
+
+void sbuffer_reader_unregister(sbuffer_reader_t ** reader)
+{
+  if (reader == NULL || *reader == NULL) return;
+  sbuffer_t * buffer = (*reader)->buffer;
+  atomic_store(&(*reader)->active, 0);
+  // a producer may be waiting for this reader
+  sbuffer_ring_wake(buffer, &buffer->not_full, &buffer->multi.writers_waiting);
+  *reader = NULL;
+}
+
+int sbuffer_read_batch(sbuffer_reader_t * reader, sensor_data_t * data, size_t max, size_t * count, int timeout_ms)
+{
+  if (reader == NULL || count == NULL || max == 0) return SBUFFER_FAILURE;
+  sbuffer_t * buffer = reader->buffer;
+  sbuffer_multi_t * multi = &buffer->multi;
+  size_t pos = atomic_load_explicit(&reader->pos, memory_order_relaxed);
+  size_t avail = atomic_load_explicit(&multi->write_pos, memory_order_acquire) - pos;
+  *count = 0;
+  if (avail == 0)
+  {
+    struct timespec outtime;
+    const struct timespec * deadline = calculate_outtime(&outtime, timeout_ms);
+    int ret = SBUFFER_NO_DATA;
+    pthread_mutex_lock(&buffer->mutex);
+    atomic_fetch_add(&multi->readers_waiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while ((avail = atomic_load_explicit(&multi->write_pos, memory_order_acquire) - pos) == 0)
+    {
+      if (atomic_load(&buffer->closed) &&
+          (avail = atomic_load_explicit(&multi->write_pos, memory_order_acquire) - pos) == 0)
+      {
+        ret = SBUFFER_CLOSED;
+        break;
+      }
+      if (sbuffer_wait(buffer, &buffer->cond, deadline) == ETIMEDOUT &&
+          (avail = atomic_load_explicit(&multi->write_pos, memory_order_acquire) - pos) == 0)
+        break;
+    }
+    atomic_fetch_sub(&multi->readers_waiting, 1);
+    pthread_mutex_unlock(&buffer->mutex);
+    if (avail == 0) return ret;
+  }
+  if (avail > max) avail = max;
+  for (size_t i = 0; i < avail; i++)
+    data[i] = multi->slots[(pos + i) & multi->mask].data;
+  atomic_store_explicit(&reader->pos, pos + avail, memory_order_release);
+  *count = avail;
+  sbuffer_ring_wake(buffer, &buffer->not_full, &multi->writers_waiting);
+  return SBUFFER_SUCCESS;
+}
+
+int sbuffer_read(sbuffer_reader_t * reader, sensor_data_t * data)
 {
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	outtime->tv_sec = now.tv_sec + TIMEOUT * 2;
-	outtime->tv_nsec = now.tv_usec * 1000;
+  size_t count;
+  return sbuffer_read_batch(reader, data, 1, &count, SBUFFER_WAIT_FOREVER);
 }
 
 int sbuffer_remove(sbuffer_t * buffer,sensor_data_t * data)
 {
   sbuffer_node_t * dummy;
-  if (buffer == NULL) return SBUFFER_FAILURE;
+  size_t count;
+  if (buffer == NULL || buffer->backend == SBUFFER_MULTI) return SBUFFER_FAILURE;
+  if (buffer->backend == SBUFFER_RING) return sbuffer_ring_remove_batch(buffer, data, 1, &count, SBUFFER_WAIT_FOREVER);
   pthread_mutex_lock(&buffer->mutex);
   while (buffer->head == NULL){
-	  struct timespec outtime;
-	  calculate_outtime(&outtime);
-	  if (pthread_cond_timedwait(&buffer->cond, &buffer->mutex, &outtime) == ETIMEDOUT){
+	  if (atomic_load(&buffer->closed)){
 		  pthread_mutex_unlock(&buffer->mutex);
-		  return SBUFFER_NO_DATA;
+		  return SBUFFER_CLOSED;
 	  }
+	  pthread_cond_wait(&buffer->cond, &buffer->mutex);
   }
   *data = buffer->head->element.data;
   dummy = buffer->head;
@@ -97,13 +497,56 @@ int sbuffer_remove(sbuffer_t * buffer,sensor_data_t * data)
 }
 
 
+int sbuffer_remove_batch(sbuffer_t * buffer, sensor_data_t * data, size_t max, size_t * count, int timeout_ms)
+{
+  sbuffer_node_t * first, * last = NULL;
+  struct timespec outtime;
+  if (buffer == NULL || count == NULL || max == 0 || buffer->backend == SBUFFER_MULTI) return SBUFFER_FAILURE;
+  if (buffer->backend == SBUFFER_RING) return sbuffer_ring_remove_batch(buffer, data, max, count, timeout_ms);
+  const struct timespec * deadline = calculate_outtime(&outtime, timeout_ms);
+  *count = 0;
+  pthread_mutex_lock(&buffer->mutex);
+  while (buffer->head == NULL){
+	  if (atomic_load(&buffer->closed)){
+		  pthread_mutex_unlock(&buffer->mutex);
+		  return SBUFFER_CLOSED;
+	  }
+	  if (sbuffer_wait(buffer, &buffer->cond, deadline) == ETIMEDOUT && buffer->head == NULL){
+		  pthread_mutex_unlock(&buffer->mutex);
+		  return SBUFFER_NO_DATA;
+	  }
+  }
+  // detach up to 'max' nodes, copying and freeing them is done outside the lock
+  first = buffer->head;
+  while (buffer->head && *count < max)
+  {
+    last = buffer->head;
+    buffer->head = buffer->head->next;
+    (*count)++;
+  }
+  if (buffer->head == NULL) buffer->tail = NULL;
+  pthread_mutex_unlock(&buffer->mutex);
+  last->next = NULL;
+  for (size_t i = 0; first; i++)
+  {
+    sbuffer_node_t * dummy = first;
+    data[i] = first->element.data;
+    first = first->next;
+    free(dummy);
+  }
+  return SBUFFER_SUCCESS;
+}
+
+
 int sbuffer_insert(sbuffer_t * buffer, sensor_data_t * data)
 {
   sbuffer_node_t * dummy;
   if (buffer == NULL) return SBUFFER_FAILURE;
+  if (buffer->backend != SBUFFER_LIST) return sbuffer_insert_batch(buffer, data, 1);
   pthread_mutex_lock(&buffer->mutex);
   dummy = malloc(sizeof(sbuffer_node_t));
-  if (dummy == NULL){
+  if (dummy == NULL || atomic_load(&buffer->closed)){
+	  free(dummy);
 	  pthread_mutex_unlock(&buffer->mutex);
 	  return SBUFFER_FAILURE;
   }
@@ -124,6 +567,58 @@ int sbuffer_insert(sbuffer_t * buffer, sensor_data_t * data)
 }
 
 
-
-
-
+int sbuffer_insert_batch(sbuffer_t * buffer, const sensor_data_t * data, size_t count)
+{
+  sbuffer_node_t * first = NULL, * last = NULL;
+  if (buffer == NULL || atomic_load(&buffer->closed)) return SBUFFER_FAILURE;
+  if (count == 0) return SBUFFER_SUCCESS;
+  if (buffer->backend == SBUFFER_MULTI) return sbuffer_multi_insert_batch(buffer, data, count);
+  if (buffer->backend == SBUFFER_RING)
+  {
+    int ret = SBUFFER_SUCCESS;
+    for (size_t i = 0; i < count && ret == SBUFFER_SUCCESS; i++)
+      if (!sbuffer_ring_push(buffer, &data[i])) ret = SBUFFER_FAILURE;
+    sbuffer_ring_wake(buffer, &buffer->cond, &buffer->ring.readers_waiting);
+    return ret;
+  }
+  // build the chain outside the lock, so the consumer is only held up by the splice
+  for (size_t i = 0; i < count; i++)
+  {
+    sbuffer_node_t * dummy = malloc(sizeof(sbuffer_node_t));
+    if (dummy == NULL){
+      while (first){
+        dummy = first;
+        first = first->next;
+        free(dummy);
+      }
+      return SBUFFER_FAILURE;
+    }
+    dummy->element.data = data[i];
+    dummy->next = NULL;
+    if (last == NULL) first = dummy;
+    else last->next = dummy;
+    last = dummy;
+  }
+  pthread_mutex_lock(&buffer->mutex);
+  if (atomic_load(&buffer->closed)){
+    pthread_mutex_unlock(&buffer->mutex);
+    while (first){
+      last = first;
+      first = first->next;
+      free(last);
+    }
+    return SBUFFER_FAILURE;
+  }
+  if (buffer->tail == NULL) // buffer empty
+  {
+    buffer->head = first;
+  }
+  else
+  {
+    buffer->tail->next = first;
+  }
+  buffer->tail = last;
+  pthread_cond_signal(&buffer->cond);
+  pthread_mutex_unlock(&buffer->mutex);
+  return SBUFFER_SUCCESS;
+}
@@ -1,15 +1,41 @@
 #ifndef _SBUFFER_H_
 #define _SBUFFER_H_
 
+#include <stddef.h>
 #include "config.h"
 
 #define SBUFFER_FAILURE -1
 #define SBUFFER_SUCCESS 0
 #define SBUFFER_NO_DATA 1
+#define SBUFFER_CLOSED 2 // the buffer is closed and every reading was consumed
 
+#define SBUFFER_WAIT_FOREVER -1 // timeout_ms that blocks until data arrives or the buffer is closed
+
+#define SBUFFER_BATCH_SIZE 256 // readings moved per call by the batch consumers
+
+#ifndef SBUFFER_RING_CAPACITY
+  #define SBUFFER_RING_CAPACITY 65536 // default number of slots of a ring buffer
+#endif
+
+#define SBUFFER_MAX_READERS 4 // readers that can be registered on a SBUFFER_MULTI buffer
+
+/*
+ * Storage behind the sbuffer API
+ * SBUFFER_LIST : unbounded mutex protected linked list, one allocation per reading
+ * SBUFFER_RING : bounded lock-free ring of preallocated slots, insert blocks while the ring is full
+ * SBUFFER_MULTI : bounded ring where every registered reader sees every reading through its own cursor,
+ *                 a slot is reused once all readers consumed it. Read it with sbuffer_read*, not sbuffer_remove*
+ */
+typedef enum {
+  SBUFFER_LIST,
+  SBUFFER_RING,
+  SBUFFER_MULTI
+} sbuffer_backend_t;
 
 typedef struct sbuffer sbuffer_t;
 
+typedef struct sbuffer_reader sbuffer_reader_t;
+
 /*
  * All data that can be stored in the sbuffer should be encapsulated in a
  * structure, this structure can then also hold extra info needed for your implementation
@@ -24,6 +50,14 @@ typedef struct sbuffer_data sbuffer_data_t;
 int sbuffer_init(sbuffer_t ** buffer);
 
 
+/*
+ * Allocates and initializes a new shared buffer using 'backend' for storage
+ * For SBUFFER_RING and SBUFFER_MULTI 'capacity' is rounded up to a power of two (0 selects SBUFFER_RING_CAPACITY), it is ignored for SBUFFER_LIST
+ * Returns SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured
+ */
+int sbuffer_init_backend(sbuffer_t ** buffer, sbuffer_backend_t backend, size_t capacity);
+
+
 /*
  * All allocated resources are freed and cleaned up
  * Returns SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured
@@ -31,20 +65,74 @@ int sbuffer_init(sbuffer_t ** buffer);
 int sbuffer_free(sbuffer_t ** buffer);
 
 
+/*
+ * Marks 'buffer' closed by its producers: later inserts fail and blocked consumers and producers are woken
+ * Readings still in the buffer stay readable, the consumers see SBUFFER_CLOSED once they are drained
+ * Returns SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured
+ */
+int sbuffer_close(sbuffer_t * buffer);
+
+
 /*
  * Removes the first data in 'buffer' (at the 'head') and returns this data as '*data'  
  * 'data' must point to allocated memory because this functions doesn't allocated memory
- * If 'buffer' is empty, the function doesn't block until new data becomes available but returns SBUFFER_NO_DATA
- * Returns SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured
+ * If 'buffer' is empty, the function blocks until new data becomes available or the buffer is closed
+ * Returns SBUFFER_SUCCESS on success, SBUFFER_CLOSED once the buffer is closed and empty and SBUFFER_FAILURE if an error occured
  */
 int sbuffer_remove(sbuffer_t * buffer, sensor_data_t * data);
 
 
+/*
+ * Removes up to 'max' readings from the 'head' of 'buffer' in one step and stores them in 'data', '*count' is set to the number removed
+ * 'data' must point to allocated memory for 'max' readings
+ * Waits at most 'timeout_ms' milliseconds (SBUFFER_WAIT_FOREVER to block) until at least one reading is available, then returns without waiting for more
+ * Returns SBUFFER_SUCCESS on success, SBUFFER_NO_DATA if nothing arrived in time, SBUFFER_CLOSED once the buffer is closed and empty
+ * and SBUFFER_FAILURE if an error occured
+ */
+int sbuffer_remove_batch(sbuffer_t * buffer, sensor_data_t * data, size_t max, size_t * count, int timeout_ms);
+
+
 /* Inserts the data in 'data' at the end of 'buffer' (at the 'tail')
- * Returns SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured
+ * Returns SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured or the buffer is closed
 */
 int sbuffer_insert(sbuffer_t * buffer, sensor_data_t * data);
 
 
+/* Inserts the 'count' readings in 'data' at the end of 'buffer' in one step, keeping their order
+ * Returns SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured (nothing is inserted then)
+ * or the buffer was closed (readings not yet inserted by a bounded buffer are dropped then)
+*/
+int sbuffer_insert_batch(sbuffer_t * buffer, const sensor_data_t * data, size_t count);
+
+
+/*
+ * Registers a new reader on a SBUFFER_MULTI buffer and returns it as '*reader'
+ * The reader sees every reading inserted after this call, so register all readers before the producers start
+ * Returns SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured (wrong backend, too many readers)
+ */
+int sbuffer_reader_register(sbuffer_t * buffer, sbuffer_reader_t ** reader);
+
+
+/*
+ * Unregisters 'reader', the producers no longer wait for it to consume its readings
+ * '*reader' is set to NULL, its memory is owned by the buffer and released by sbuffer_free
+ */
+void sbuffer_reader_unregister(sbuffer_reader_t ** reader);
+
+
+/*
+ * Reads the next reading for 'reader' without removing it for the other readers
+ * Behaves like sbuffer_remove otherwise
+ */
+int sbuffer_read(sbuffer_reader_t * reader, sensor_data_t * data);
+
+
+/*
+ * Reads up to 'max' readings for 'reader' without removing them for the other readers
+ * Behaves like sbuffer_remove_batch otherwise
+ */
+int sbuffer_read_batch(sbuffer_reader_t * reader, sensor_data_t * data, size_t max, size_t * count, int timeout_ms);
+
+
 #endif  //_SBUFFER_H_
 
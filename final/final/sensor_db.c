@@ -1,12 +1,114 @@
+#define _GNU_SOURCE
+
  #include <stdio.h>
 #include <stdlib.h>
 #include "config.h"
 #include <sqlite3.h>
 #include <inttypes.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "sensor_db.h"
+#include "logger.h"
+#include "timeutil.h"
 #define LOG_MAX_LEN 1024
-void write_fifo(const char* log_event);
+
+struct dbconn{
+    sqlite3 *db;
+    sqlite3_stmt *insert_stmt;// prepared once per connection, reset after every row
+    sqlite3_stmt *range_stmt;// readings of one sensor in a time range
+    sqlite3_stmt *latest_stmt;// newest readings of one sensor
+};
+
+// every index of the table, (sensor_id, timestamp) serves the per sensor queries, timestamp the time queries
+#define SQL_CREATE_INDEXES \
+    "CREATE INDEX IF NOT EXISTS "TO_STRING(TABLE_NAME)"_sensor_ts ON "TO_STRING(TABLE_NAME)"(sensor_id, timestamp);" \
+    "CREATE INDEX IF NOT EXISTS "TO_STRING(TABLE_NAME)"_ts ON "TO_STRING(TABLE_NAME)"(timestamp);"
+
+/*
+ * Pragmas of every durability profile, the journal and sync mode decide what a crash can cost:
+ * safe : rollback journal, fsync on every commit, survives power loss
+ * balanced : WAL, fsync at checkpoints only, a power loss can drop the last commits but never corrupts
+ * fast : WAL without any fsync and large caches, for bulk ingest where the data can be replayed
+ */
+static const struct{
+    const char *name;
+    const char *journal_mode;
+    const char *synchronous;
+    long long mmap_size;// bytes of the database file that are memory mapped
+    int cache_size;// page cache in KiB
+} db_profiles[] = {
+    [DB_PROFILE_SAFE] = {"safe", "DELETE", "FULL", 0, 2048},
+    [DB_PROFILE_BALANCED] = {"balanced", "WAL", "NORMAL", 64LL << 20, 16384},
+    [DB_PROFILE_FAST] = {"fast", "WAL", "OFF", 256LL << 20, 65536},
+};
+
+int db_profile_from_name(const char * name, db_profile_t * profile)
+{
+    for (int i = 0; i < (int)(sizeof(db_profiles) / sizeof(db_profiles[0])); i++){
+        if (strcmp(name, db_profiles[i].name) == 0){
+            *profile = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// keeps the first column of the first result row
+static int pragma_result(void *ret, int argc, char **argv, char **az_col_name)
+{
+    char *value = (char *)ret;
+    if (argc >= 1 && argv[0] != NULL && value[0] == '\0')
+        snprintf(value, 32, "%s", argv[0]);
+    return 0;
+}
+
+// reads the current value of pragma 'name' into 'value' (32 bytes), "?" if it can't be read
+static void db_pragma_value(sqlite3 *db, const char *name, char *value)
+{
+    char *sql_pragma = sqlite3_mprintf("PRAGMA %s;", name);
+    value[0] = '\0';
+    if (sql_pragma == NULL || sqlite3_exec(db, sql_pragma, pragma_result, value, NULL) != SQLITE_OK || value[0] == '\0')
+        snprintf(value, 32, "?");
+    sqlite3_free(sql_pragma);
+}
+
+// set the pragmas of 'profile' on 'db' and log what sqlite actually applied
+static int db_apply_profile(sqlite3 *db, db_profile_t profile)
+{
+    static const char *sync_names[] = {"OFF", "NORMAL", "FULL", "EXTRA"};
+    char journal_mode[32] = "", synchronous[32], mmap_size[32], cache_size[32], page_size[32];
+    char log_buf[LOG_MAX_LEN];
+    char *err_msg = NULL;
+    char *sql_pragma = sqlite3_mprintf("PRAGMA journal_mode = %s; PRAGMA synchronous = %s; PRAGMA mmap_size = %lld;"
+        " PRAGMA cache_size = -%d; PRAGMA temp_store = MEMORY;",
+        db_profiles[profile].journal_mode, db_profiles[profile].synchronous,
+        db_profiles[profile].mmap_size, db_profiles[profile].cache_size);
+    int ret = sqlite3_exec(db, sql_pragma, pragma_result, journal_mode, &err_msg);
+    sqlite3_free(sql_pragma);
+    if (ret != SQLITE_OK){
+		snprintf(log_buf, LOG_MAX_LEN, "SQL error: %s\n", err_msg);
+		log_event(log_buf);
+        sqlite3_free(err_msg);
+        return 1;
+    }
+    // read back, sqlite ignores what it doesn't support, e.g. mmap_size without memory mapping compiled in
+    db_pragma_value(db, "synchronous", synchronous);
+    db_pragma_value(db, "mmap_size", mmap_size);
+    db_pragma_value(db, "cache_size", cache_size);
+    db_pragma_value(db, "page_size", page_size);
+    int sync_level = atoi(synchronous);
+    // a negative cache_size is in KiB, a positive one in pages
+    long long cache_kib = atoll(cache_size);
+    cache_kib = cache_kib < 0 ? -cache_kib : cache_kib * atoll(page_size) / 1024;
+	snprintf(log_buf, LOG_MAX_LEN, "SQL profile %s: journal_mode=%s synchronous=%s mmap_size=%s cache_size=%lldKiB\n",
+		db_profiles[profile].name, journal_mode,
+		synchronous[0] != '?' && sync_level >= 0 && sync_level <= 3 ? sync_names[sync_level] : synchronous, mmap_size, cache_kib);
+	log_event(log_buf);
+    return 0;
+}
 
 //judge if table exist
 int table_exist(void *ret, int argc, char **argv, char **az_col_name)
@@ -18,39 +120,20 @@ int table_exist(void *ret, int argc, char **argv, char **az_col_name)
     return 0;
 }
 
-/*
-* Reads continiously all data from the shared buffer data structure and stores this into the database
-* When *buffer becomes NULL the method finishes. This method will NOT automatically disconnect from the db
-*/
-void storagemgr_parse_sensor_data(DBCONN * conn, sbuffer_t ** buffer)
+// run a statement without result rows, log the error if it fails
+static int db_exec(DBCONN * conn, const char * sql)
 {
-	char log_buf[LOG_MAX_LEN];
-	int attempts = 3, res;
-	if ((*buffer) == NULL)
-		return;
-	while (1){
-		sensor_data_t data;
-		if (sbuffer_remove(*buffer, &data) != SBUFFER_SUCCESS)
-			break;
-		for (int i = 0; i < attempts; i++){
-			res = insert_sensor(conn, data.id, data.value, data.ts);
-			if (!res){
-				//snprintf(log_buf, LOG_MAX_LEN, "[%" PRIu16 ", %lf, %ld]\n", data.id, data.value, data.ts);
-				//write_fifo(log_buf);
-				break;
-			}
-			else{
-				snprintf(log_buf, LOG_MAX_LEN, "Connection to SQL server lost, try attempt times %d\n", i);
-				write_fifo(log_buf);
-				sleep(3);
-			}
-		}
-		if (res){
-			
-			break;
-		}
-	}
+    char *err_msg = NULL;
+    if (sqlite3_exec(conn->db, sql, 0, 0, &err_msg) != SQLITE_OK){
+		char log_buf[LOG_MAX_LEN];
+		snprintf(log_buf, LOG_MAX_LEN, "SQL error: %s\n", err_msg);
+		log_event(log_buf);
+        sqlite3_free(err_msg);
+        return 1;
+    }
+    return 0;
 }
+
 /*
  * Make a connection to the database server
  * Create (open) a database with name DB_NAME having 1 table named TABLE_NAME  
@@ -59,6 +142,15 @@ void storagemgr_parse_sensor_data(DBCONN * conn, sbuffer_t ** buffer)
  */
 
 DBCONN * init_connection(char clear_up_flag)
+{
+    return init_connection_profile(clear_up_flag, DB_DEFAULT_PROFILE);
+}
+
+
+/*
+ * Same as init_connection, the connection is set up with the pragmas of durability profile 'profile'
+ */
+DBCONN * init_connection_profile(char clear_up_flag, db_profile_t profile)
 {
     sqlite3 *db = NULL;
     char *err_msg = NULL;
@@ -69,19 +161,24 @@ DBCONN * init_connection(char clear_up_flag)
     int ret = sqlite3_open(TO_STRING(DB_NAME), &db);
     if (ret != SQLITE_OK){
 		snprintf(log_buf, LOG_MAX_LEN, "Unable to connect to SQL server : %s\n", sqlite3_errmsg(db));
-		write_fifo(log_buf);
+		log_event(log_buf);
         //printf("Cannot open database: %s\n", sqlite3_errmsg(db));
         sqlite3_close(db);
         sqlite3_free(sql_exsit);
         return NULL;
     }
 	snprintf(log_buf, LOG_MAX_LEN, "%s\n","Connection to SQL server established.");
-	write_fifo(log_buf);
+	log_event(log_buf);
+    if (db_apply_profile(db, profile) != 0){
+        sqlite3_close(db);
+        sqlite3_free(sql_exsit);
+        return NULL;
+    }
     //query if table exsit
     ret = sqlite3_exec(db, sql_exsit, table_exist, &table_cnt, &err_msg);
     if (ret != SQLITE_OK){
 		snprintf(log_buf, LOG_MAX_LEN, "SQL error: %s\n", err_msg);
-		write_fifo(log_buf);
+		log_event(log_buf);
         //printf("SQL error1: %s\n", err_msg);
         sqlite3_free(err_msg);
         sqlite3_close(db);
@@ -94,7 +191,7 @@ DBCONN * init_connection(char clear_up_flag)
         ret = sqlite3_exec(db, sql_create, 0, 0, &err_msg);
         if (ret != SQLITE_OK){
 			snprintf(log_buf, LOG_MAX_LEN, "New table %s created failure : %s\n", TO_STRING(TABLE_NAME), err_msg);
-			write_fifo(log_buf);
+			log_event(log_buf);
             //printf("SQL error2: %s\n", err_msg);
             sqlite3_free(err_msg);
             sqlite3_close(db);
@@ -102,7 +199,7 @@ DBCONN * init_connection(char clear_up_flag)
             return NULL;
         }
 		snprintf(log_buf, LOG_MAX_LEN, "New table %s created.\n", TO_STRING(TABLE_NAME));
-		write_fifo(log_buf);
+		log_event(log_buf);
     }
     else{
         if (clear_up_flag == 1){
@@ -111,7 +208,7 @@ DBCONN * init_connection(char clear_up_flag)
             ret = sqlite3_exec(db, sql_del, &table_exist, &table_cnt, &err_msg);
             if (ret != SQLITE_OK){
 				snprintf(log_buf, LOG_MAX_LEN, "Cleanup table %s failure : %s\n", TO_STRING(TABLE_NAME), err_msg);
-				write_fifo(log_buf);
+				log_event(log_buf);
                 //printf("SQL error3: %s\n", err_msg);
                 sqlite3_free(err_msg);
                 sqlite3_close(db);
@@ -121,7 +218,36 @@ DBCONN * init_connection(char clear_up_flag)
         }
     }
     sqlite3_free(sql_exsit);
-    return db;
+    ret = sqlite3_exec(db, SQL_CREATE_INDEXES, 0, 0, &err_msg);
+    if (ret != SQLITE_OK){
+		snprintf(log_buf, LOG_MAX_LEN, "Index on %s created failure : %s\n", TO_STRING(TABLE_NAME), err_msg);
+		log_event(log_buf);
+        sqlite3_free(err_msg);
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    DBCONN *conn = calloc(1, sizeof(DBCONN));
+    if (conn == NULL){
+        sqlite3_close(db);
+        return NULL;
+    }
+    conn->db = db;
+    // the statements are parsed and planned once, each call only binds its values
+    if (sqlite3_prepare_v2(db, "INSERT INTO "TO_STRING(TABLE_NAME)"(sensor_id, sensor_value, timestamp) VALUES (?1, ?2, ?3);",
+            -1, &conn->insert_stmt, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, "SELECT sensor_id, sensor_value, timestamp FROM "TO_STRING(TABLE_NAME)
+            " WHERE sensor_id = ?1 AND timestamp BETWEEN ?2 AND ?3 ORDER BY timestamp;",
+            -1, &conn->range_stmt, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, "SELECT sensor_id, sensor_value, timestamp FROM "TO_STRING(TABLE_NAME)
+            " WHERE sensor_id = ?1 ORDER BY timestamp DESC LIMIT ?2;",
+            -1, &conn->latest_stmt, NULL) != SQLITE_OK){
+		snprintf(log_buf, LOG_MAX_LEN, "SQL error: %s\n", sqlite3_errmsg(db));
+		log_event(log_buf);
+        disconnect(conn);
+        return NULL;
+    }
+    return conn;
 
 }
 
@@ -131,11 +257,17 @@ DBCONN * init_connection(char clear_up_flag)
  */
 void disconnect(DBCONN *conn)
 {
+    if (conn == NULL)
+        return;
+    sqlite3_finalize(conn->insert_stmt);
+    sqlite3_finalize(conn->range_stmt);
+    sqlite3_finalize(conn->latest_stmt);
     // close database
-    int ret = sqlite3_close(conn);
+    int ret = sqlite3_close(conn->db);
     if (ret == SQLITE_BUSY){
         printf("SQL error: close failure\n");
     }
+    free(conn);
 }
 
 
@@ -145,51 +277,179 @@ void disconnect(DBCONN *conn)
  */
 int insert_sensor(DBCONN * conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts)
 {
-    char *err_msg = NULL;
-	
-    //initial sql sentence
-    char *sql_insert = sqlite3_mprintf("INSERT INTO %s(sensor_id, sensor_value, timestamp) VALUES (%u, %lf, %ld)", TO_STRING(TABLE_NAME),
-        id, value, ts);
-    // insert sensor data to database
-    int ret = sqlite3_exec(conn, sql_insert, 0, 0, &err_msg);
-    if (ret != SQLITE_OK){
+    if (conn == NULL)
+        return 1;
+    sqlite3_stmt *stmt = conn->insert_stmt;
+    // bind the reading to the prepared insert
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_double(stmt, 2, value);
+    sqlite3_bind_int64(stmt, 3, ts);
+    int ret = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (ret != SQLITE_DONE){
 		char log_buf[LOG_MAX_LEN];
-		snprintf(log_buf, LOG_MAX_LEN, "SQL error: %s\n", err_msg);
-		write_fifo(log_buf);
-        //printf("SQL error4: %s\n", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_close(conn);
-        sqlite3_free(sql_insert);
+		snprintf(log_buf, LOG_MAX_LEN, "SQL error: %s\n", sqlite3_errmsg(conn->db));
+		log_event(log_buf);
         return 1;
     }
-    sqlite3_free(sql_insert);
     return 0;
 }
 
 
 /*
- * Write an INSERT query to insert all sensor measurements available in the file 'sensor_data'
+ * Insert 'count' sensor measurements in one transaction, so they are committed (and synced to disk) together
+ * If an error occurs the transaction is rolled back, none of 'data' is stored and the same rows can be retried
  * Return zero for success, and non-zero if an error occurs
  */
-int insert_sensor_from_file(DBCONN * conn, FILE * sensor_data)
+int insert_sensor_batch(DBCONN * conn, const sensor_data_t * data, size_t count)
+{
+    if (conn == NULL || db_exec(conn, "BEGIN;") != 0)
+        return 1;
+    for (size_t i = 0; i < count; i++){
+        if (insert_sensor(conn, data[i].id, data[i].value, data[i].ts) != 0){
+            db_exec(conn, "ROLLBACK;");
+            return 1;
+        }
+    }
+    if (db_exec(conn, "COMMIT;") != 0){
+        // a failed COMMIT can leave the transaction open
+        if (!sqlite3_get_autocommit(conn->db))
+            db_exec(conn, "ROLLBACK;");
+        return 1;
+    }
+    return 0;
+}
+
+
+// bytes of one reading in the sensor_data file format: <sensor_id><temperature><timestamp>
+#define SENSOR_RECORD_SIZE (sizeof(sensor_id_t) + sizeof(sensor_value_t) + sizeof(sensor_ts_t))
+
+// insert 'count' records in file format with the prepared insert, in one transaction
+static int import_records(DBCONN * conn, const unsigned char * records, size_t count)
 {
     sensor_id_t id;
     sensor_value_t value;
     sensor_ts_t ts;
-    // read data from sensor data file 
-    while (fread(&id, sizeof(uint16_t), 1, sensor_data)){
-        fread(&value, sizeof(double), 1, sensor_data);
-        fread(&ts, sizeof(time_t), 1, sensor_data);
-        //insert sensor data into database
+    if (db_exec(conn, "BEGIN;") != 0)
+        return 1;
+    for (size_t i = 0; i < count; i++){
+        memcpy(&id, records, sizeof(id));
+        memcpy(&value, records + sizeof(id), sizeof(value));
+        memcpy(&ts, records + sizeof(id) + sizeof(value), sizeof(ts));
+        records += SENSOR_RECORD_SIZE;
         if (insert_sensor(conn, id, value, ts) != 0){
-            printf("Insert sensor data error: %u, %lf, %ld\n", id, value, ts);
+            db_exec(conn, "ROLLBACK;");
             return 1;
         }
     }
+    if (db_exec(conn, "COMMIT;") != 0){
+        if (!sqlite3_get_autocommit(conn->db))
+            db_exec(conn, "ROLLBACK;");
+        return 1;
+    }
     return 0;
 }
 
 
+/*
+ * Bulk import of the file 'sensor_data' from its current position, see sensor_db.h
+ * A regular file is memory mapped, anything else (a pipe) is read in blocks of DB_IMPORT_ROWS records
+ */
+int import_sensor_file(DBCONN * conn, FILE * sensor_data, int flags, db_import_stats_t * stats)
+{
+    char log_buf[LOG_MAX_LEN];
+    db_import_stats_t result = {0};
+    struct stat st;
+    int ret = 0;
+    if (conn == NULL || sensor_data == NULL)
+        return 1;
+    int64_t start_ms = timeutil_now_ms();
+    off_t start = ftello(sensor_data);
+    int fd = fileno(sensor_data);
+    if ((flags & DB_IMPORT_DEFER_INDEXES) &&
+        db_exec(conn, "DROP INDEX IF EXISTS "TO_STRING(TABLE_NAME)"_sensor_ts;"
+            "DROP INDEX IF EXISTS "TO_STRING(TABLE_NAME)"_ts;") != 0)
+        return 1;
+    int regular = start >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (regular && st.st_size > start){
+        size_t len = st.st_size - start;
+        // map from the page the current position is on
+        off_t map_start = start & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+        unsigned char *map = mmap(NULL, len + (start - map_start), PROT_READ, MAP_PRIVATE, fd, map_start);
+        if (map == MAP_FAILED){
+            ret = 1;
+        } else{
+            madvise(map, len + (start - map_start), MADV_SEQUENTIAL);
+            const unsigned char *records = map + (start - map_start);
+            size_t total = len / SENSOR_RECORD_SIZE;
+            result.skipped_bytes = len % SENSOR_RECORD_SIZE;
+            while (!ret && result.rows < total){
+                size_t n = total - result.rows < DB_IMPORT_ROWS ? total - result.rows : DB_IMPORT_ROWS;
+                ret = import_records(conn, records + result.rows * SENSOR_RECORD_SIZE, n);
+                if (!ret)
+                    result.rows += n;
+            }
+            munmap(map, len + (start - map_start));
+            // leave the stream behind the imported records
+            fseeko(sensor_data, start + result.rows * SENSOR_RECORD_SIZE, SEEK_SET);
+        }
+    } else if (!regular){
+        unsigned char *block = malloc(DB_IMPORT_ROWS * SENSOR_RECORD_SIZE);
+        size_t len = 0, n;
+        ret = block == NULL;
+        while (!ret && (n = fread(block + len, 1, DB_IMPORT_ROWS * SENSOR_RECORD_SIZE - len, sensor_data)) > 0){
+            len += n;
+            // a partial record stays in front of the block for the next read
+            size_t count = len / SENSOR_RECORD_SIZE;
+            if (count == 0 || (len < DB_IMPORT_ROWS * SENSOR_RECORD_SIZE && !feof(sensor_data)))
+                continue;
+            ret = import_records(conn, block, count);
+            if (!ret){
+                result.rows += count;
+                len -= count * SENSOR_RECORD_SIZE;
+                memmove(block, block + count * SENSOR_RECORD_SIZE, len);
+            }
+        }
+        if (!ret && len >= SENSOR_RECORD_SIZE){
+            ret = import_records(conn, block, len / SENSOR_RECORD_SIZE);
+            if (!ret){
+                result.rows += len / SENSOR_RECORD_SIZE;
+                len %= SENSOR_RECORD_SIZE;
+            }
+        }
+        ret = ret || ferror(sensor_data);
+        result.skipped_bytes = ret ? 0 : len;
+        free(block);
+    }
+    // the indexes are built once over all rows, also after a failure
+    if ((flags & DB_IMPORT_DEFER_INDEXES) && db_exec(conn, SQL_CREATE_INDEXES) != 0)
+        ret = 1;
+    result.elapsed_ms = timeutil_now_ms() - start_ms;
+    result.rows_per_sec = result.elapsed_ms > 0 ? result.rows * 1000.0 / result.elapsed_ms : result.rows;
+    if (result.skipped_bytes > 0){
+		snprintf(log_buf, LOG_MAX_LEN, "Import ignored %" PRIu64 " trailing bytes, the file is not a whole number of %zu byte records\n",
+			result.skipped_bytes, SENSOR_RECORD_SIZE);
+		log_event(log_buf);
+    }
+	snprintf(log_buf, LOG_MAX_LEN, "Import %s: %" PRIu64 " readings in %" PRId64 " ms, %.0f rows/s\n",
+		ret ? "failed" : "done", result.rows, result.elapsed_ms, result.rows_per_sec);
+	log_event(log_buf);
+    if (stats != NULL)
+        *stats = result;
+    return ret;
+}
+
+
+/*
+ * Insert all sensor measurements available in the file 'sensor_data' with the bulk import
+ * Return zero for success, and non-zero if an error occurs
+ */
+int insert_sensor_from_file(DBCONN * conn, FILE * sensor_data)
+{
+    return import_sensor_file(conn, sensor_data, 0, NULL);
+}
+
+
 /*
   * Write a SELECT query to select all sensor measurements in the table 
   * The callback function is applied to every row in the result
@@ -201,11 +461,10 @@ int find_sensor_all(DBCONN * conn, callback_t f)
     //initial select sql
     char *sql_select = sqlite3_mprintf("SELECT * FROM %q", TO_STRING(TABLE_NAME));
     // query all sensor data
-    int ret = sqlite3_exec(conn, sql_select, f, 0, &err_msg);
+    int ret = sqlite3_exec(conn->db, sql_select, f, 0, &err_msg);
     if (ret != SQLITE_OK){
         printf("SQL error: %s\n", err_msg);
         sqlite3_free(err_msg);
-        sqlite3_close(conn);
         sqlite3_free(sql_select);
         return 1;
     }
@@ -225,11 +484,10 @@ int find_sensor_by_value(DBCONN * conn, sensor_value_t value, callback_t f)
     //initial select sql
     char *sql_select = sqlite3_mprintf("SELECT * FROM %q where sensor_value = %lf", TO_STRING(TABLE_NAME), value);
     // query sensor by value
-    int ret = sqlite3_exec(conn, sql_select, f, 0, &err_msg);
+    int ret = sqlite3_exec(conn->db, sql_select, f, 0, &err_msg);
     if (ret != SQLITE_OK){
         printf("SQL error: %s\n", err_msg);
         sqlite3_free(err_msg);
-        sqlite3_close(conn);
         sqlite3_free(sql_select);
         return 1;
     }
@@ -250,11 +508,10 @@ int find_sensor_exceed_value(DBCONN * conn, sensor_value_t value, callback_t f)
     //initial select sql
     char *sql_select = sqlite3_mprintf("SELECT * FROM %q where sensor_value > %lf", TO_STRING(TABLE_NAME), value);
     // query sensor data 
-    int ret = sqlite3_exec(conn, sql_select, f, 0, &err_msg);
+    int ret = sqlite3_exec(conn->db, sql_select, f, 0, &err_msg);
     if (ret != SQLITE_OK){
         printf("SQL error: %s\n", err_msg);
         sqlite3_free(err_msg);
-        sqlite3_close(conn);
         sqlite3_free(sql_select);
         return 1;
     }
@@ -274,11 +531,10 @@ int find_sensor_by_timestamp(DBCONN * conn, sensor_ts_t ts, callback_t f)
     //initial select sql
     char *sql_select = sqlite3_mprintf("SELECT * FROM %q where timestamp = %ld", TO_STRING(TABLE_NAME), ts);
     // query sensor data
-    int ret = sqlite3_exec(conn, sql_select, f, 0, &err_msg);
+    int ret = sqlite3_exec(conn->db, sql_select, f, 0, &err_msg);
     if (ret != SQLITE_OK){
         printf("SQL error: %s\n", err_msg);
         sqlite3_free(err_msg);
-        sqlite3_close(conn);
         sqlite3_free(sql_select);
         return 1;
     }
@@ -298,11 +554,10 @@ int find_sensor_after_timestamp(DBCONN * conn, sensor_ts_t ts, callback_t f)
     //initial select sql
     char *sql_select = sqlite3_mprintf("SELECT * FROM %q where timestamp > %ld", TO_STRING(TABLE_NAME), ts);
     // query sensor data
-    int ret = sqlite3_exec(conn, sql_select, f, 0, &err_msg);
+    int ret = sqlite3_exec(conn->db, sql_select, f, 0, &err_msg);
     if (ret != SQLITE_OK){
         printf("SQL error: %s\n", err_msg);
         sqlite3_free(err_msg);
-        sqlite3_close(conn);
         sqlite3_free(sql_select);
         return 1;
     }
@@ -311,3 +566,137 @@ int find_sensor_after_timestamp(DBCONN * conn, sensor_ts_t ts, callback_t f)
 }
 
 
+// step a bound query and hand every row to 'f' as a reading, the statement is reset for the next call
+static int find_sensor_rows(DBCONN * conn, sqlite3_stmt * stmt, sensor_callback_t f, void * arg)
+{
+    int ret;
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW){
+        sensor_data_t data;
+        data.id = sqlite3_column_int(stmt, 0);
+        data.value = sqlite3_column_double(stmt, 1);
+        data.ts = sqlite3_column_int64(stmt, 2);
+        if (f(arg, &data) != 0){
+            ret = SQLITE_DONE;
+            break;
+        }
+    }
+    sqlite3_reset(stmt);
+    if (ret != SQLITE_DONE){
+        printf("SQL error: %s\n", sqlite3_errmsg(conn->db));
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * Return all sensor measurements of sensor 'id' with a timestamp from 'from' up to and including 'to', oldest first
+ * The callback function is applied to every row in the result until it returns non-zero
+ * Return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_range(DBCONN * conn, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, sensor_callback_t f, void * arg)
+{
+    if (conn == NULL)
+        return 1;
+    sqlite3_bind_int(conn->range_stmt, 1, id);
+    sqlite3_bind_int64(conn->range_stmt, 2, from);
+    sqlite3_bind_int64(conn->range_stmt, 3, to);
+    return find_sensor_rows(conn, conn->range_stmt, f, arg);
+}
+
+
+/*
+ * Return the 'n' most recent sensor measurements of sensor 'id', newest first
+ * The callback function is applied to every row in the result until it returns non-zero
+ * Return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_latest(DBCONN * conn, sensor_id_t id, int n, sensor_callback_t f, void * arg)
+{
+    if (conn == NULL)
+        return 1;
+    sqlite3_bind_int(conn->latest_stmt, 1, id);
+    sqlite3_bind_int(conn->latest_stmt, 2, n);
+    return find_sensor_rows(conn, conn->latest_stmt, f, arg);
+}
+
+
+struct dbcursor{
+    DBCONN *conn;
+    sqlite3_stmt *stmt;// owned by the cursor, finalized on close
+    int done;// the last row was fetched
+};
+
+
+/*
+ * Open a cursor over the sensor measurements selected by 'query'
+ * Return the cursor for success, NULL if an error occurs
+ */
+DBCURSOR * open_sensor_cursor(DBCONN * conn, const db_query_t * query)
+{
+    if (conn == NULL || query == NULL)
+        return NULL;
+    DBCURSOR *cursor = calloc(1, sizeof(DBCURSOR));
+    if (cursor == NULL)
+        return NULL;
+    cursor->conn = conn;
+    // both orders run on an index, (sensor_id, timestamp) for one sensor and timestamp for all of them
+    char *sql_select = sqlite3_mprintf("SELECT sensor_id, sensor_value, timestamp FROM %q"
+        " WHERE %s timestamp BETWEEN ?2 AND ?3 ORDER BY timestamp %s LIMIT ?4;",
+        TO_STRING(TABLE_NAME), query->all_sensors ? "" : "sensor_id = ?1 AND", query->newest_first ? "DESC" : "ASC");
+    if (sql_select == NULL || sqlite3_prepare_v2(conn->db, sql_select, -1, &cursor->stmt, NULL) != SQLITE_OK){
+        printf("SQL error: %s\n", sqlite3_errmsg(conn->db));
+        sqlite3_free(sql_select);
+        sqlite3_finalize(cursor->stmt);
+        free(cursor);
+        return NULL;
+    }
+    sqlite3_free(sql_select);
+    if (!query->all_sensors)
+        sqlite3_bind_int(cursor->stmt, 1, query->id);
+    sqlite3_bind_int64(cursor->stmt, 2, query->from);
+    sqlite3_bind_int64(cursor->stmt, 3, query->to);
+    sqlite3_bind_int64(cursor->stmt, 4, query->limit > 0 ? query->limit : -1);
+    return cursor;
+}
+
+
+/*
+ * Fetch the next rows of 'cursor' into 'rows', at most 'max' of them, the number is returned in '*count'
+ * '*count' is zero once all rows are fetched
+ * Return zero for success, and non-zero if an error occurs
+ */
+int fetch_sensor_cursor(DBCURSOR * cursor, sensor_data_t * rows, size_t max, size_t * count)
+{
+    *count = 0;
+    if (cursor == NULL)
+        return 1;
+    while (!cursor->done && *count < max){
+        int ret = sqlite3_step(cursor->stmt);
+        if (ret == SQLITE_DONE){
+            cursor->done = 1;
+        } else if (ret == SQLITE_ROW){
+            rows[*count].id = sqlite3_column_int(cursor->stmt, 0);
+            rows[*count].value = sqlite3_column_double(cursor->stmt, 1);
+            rows[*count].ts = sqlite3_column_int64(cursor->stmt, 2);
+            (*count)++;
+        } else{
+            printf("SQL error: %s\n", sqlite3_errmsg(cursor->conn->db));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Close 'cursor', also before all rows are fetched, and set '*cursor' to NULL
+ */
+void close_sensor_cursor(DBCURSOR ** cursor)
+{
+    if (cursor == NULL || *cursor == NULL)
+        return;
+    sqlite3_finalize((*cursor)->stmt);
+    free(*cursor);
+    *cursor = NULL;
+}
+
@@ -20,20 +20,70 @@
   #define TABLE_NAME SensorData
 #endif
 
-#define DBCONN sqlite3 
+#ifndef DB_COMMIT_ROWS
+  #define DB_COMMIT_ROWS 1024 // readings committed in one transaction at most
+#endif
 
+#ifndef DB_COMMIT_DELAY_MS
+  #define DB_COMMIT_DELAY_MS 1000 // longest time a reading waits for its transaction to commit
+#endif
 
-typedef int (*callback_t)(void *, int, char **, char **);
+#ifndef DB_IMPORT_ROWS
+  #define DB_IMPORT_ROWS 65536 // readings committed in one transaction by the bulk import
+#endif
+
+#define DB_IMPORT_DEFER_INDEXES 0x01 // import flag: drop the indexes during the import and build them once afterwards
 
 /*
-* Reads continiously all data from the shared buffer data structure and stores this into the database
-* When *buffer becomes NULL the method finishes. This method will NOT automatically disconnect from the db
-*/
-void storagemgr_parse_sensor_data(DBCONN * conn, sbuffer_t ** buffer);
+ * Durability profiles, trading fsync cost against what a crash or power loss can lose
+ * DB_PROFILE_SAFE : rollback journal, synchronous=FULL (the sqlite defaults)
+ * DB_PROFILE_BALANCED : WAL, synchronous=NORMAL, memory mapped reads
+ * DB_PROFILE_FAST : WAL, synchronous=OFF, large cache, for ingest that can be replayed
+ */
+typedef enum {
+  DB_PROFILE_SAFE,
+  DB_PROFILE_BALANCED,
+  DB_PROFILE_FAST
+} db_profile_t;
+
+#ifndef DB_DEFAULT_PROFILE
+  #define DB_DEFAULT_PROFILE DB_PROFILE_SAFE
+#endif
+
+// outcome of a bulk import
+typedef struct {
+  uint64_t rows; // readings imported
+  uint64_t skipped_bytes; // trailing bytes that don't form a whole record
+  int64_t elapsed_ms;
+  double rows_per_sec;
+} db_import_stats_t;
+
+// a database connection together with the statements prepared on it
+typedef struct dbconn DBCONN;
+
+// an open query that is read in batches of typed rows
+typedef struct dbcursor DBCURSOR;
+
+// the measurements a cursor selects
+typedef struct {
+  int all_sensors; // 1 for every sensor, 0 for sensor 'id' only
+  sensor_id_t id;
+  sensor_ts_t from; // time range, both ends included
+  sensor_ts_t to;
+  int64_t limit; // rows at most, 0 for no limit
+  int newest_first; // order by timestamp descending instead of ascending
+} db_query_t;
+
+
+typedef int (*callback_t)(void *, int, char **, char **);
+
+// typed row callback, gets the caller's 'arg' and one reading, return non-zero to stop the query
+typedef int (*sensor_callback_t)(void * arg, const sensor_data_t * data);
 
 /*
  * Make a connection to the database server
  * Create (open) a database with name DB_NAME having 1 table named TABLE_NAME  
+ * indexed on (sensor_id, timestamp) and on timestamp
  * If the table existed, clear up the existing data if clear_up_flag is set to 1
  * Return the connection for success, NULL if an error occurs
  */
@@ -41,25 +91,58 @@ DBCONN * init_connection(char clear_up_flag);
 
 
 /*
- * Disconnect from the database server
+ * Same as init_connection, the connection is set up with the pragmas of durability profile 'profile'
+ * The applied settings are logged
+ */
+DBCONN * init_connection_profile(char clear_up_flag, db_profile_t profile);
+
+
+/*
+ * Looks up the profile called 'name' ("safe", "balanced" or "fast") and stores it in '*profile'
+ * Return zero for success, and non-zero for an unknown name
+ */
+int db_profile_from_name(const char * name, db_profile_t * profile);
+
+
+/*
+ * Disconnect from the database server and free 'conn'
  */
 void disconnect(DBCONN *conn);
 
 
 /*
- * Write an INSERT query to insert a single sensor measurement
- * Return zero for success, and non-zero if an error occurs
+ * Insert a single sensor measurement with the INSERT statement prepared by init_connection
+ * Return zero for success, and non-zero if an error occurs (the connection stays open)
  */
 int insert_sensor(DBCONN * conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts);
 
 
 /*
- * Write an INSERT query to insert all sensor measurements available in the file 'sensor_data'
+ * Insert 'count' sensor measurements in one transaction
+ * If an error occurs the transaction is rolled back and none of 'data' is stored, so the same rows can be retried
+ * Return zero for success, and non-zero if an error occurs
+ */
+int insert_sensor_batch(DBCONN * conn, const sensor_data_t * data, size_t count);
+
+
+/*
+ * Insert all sensor measurements available in the file 'sensor_data', same as import_sensor_file without flags
  * Return zero for success, and non-zero if an error occurs
  */
 int insert_sensor_from_file(DBCONN * conn, FILE * sensor_data);
 
 
+/*
+ * Bulk import of the sensor_data file 'sensor_data' from its current position
+ * The file is memory mapped and inserted through the prepared insert in transactions of DB_IMPORT_ROWS readings,
+ * trailing bytes that don't form a whole record are ignored and counted
+ * With DB_IMPORT_DEFER_INDEXES in 'flags' the indexes are dropped first and built again after the load
+ * The readings imported and the rows/s are logged and returned in '*stats' if it isn't NULL
+ * Return zero for success, and non-zero if an error occurs, the transactions committed before the error are kept
+ */
+int import_sensor_file(DBCONN * conn, FILE * sensor_data, int flags, db_import_stats_t * stats);
+
+
 /*
   * Write a SELECT query to select all sensor measurements in the table 
   * The callback function is applied to every row in the result
@@ -99,5 +182,45 @@ int find_sensor_by_timestamp(DBCONN * conn, sensor_ts_t ts, callback_t f);
  */
 int find_sensor_after_timestamp(DBCONN * conn, sensor_ts_t ts, callback_t f);
 
+
+/*
+ * Return all sensor measurements of sensor 'id' with a timestamp from 'from' up to and including 'to', oldest first
+ * Runs a prepared statement on the (sensor_id, timestamp) index
+ * The callback function is applied to every row in the result until it returns non-zero
+ * Return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_range(DBCONN * conn, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, sensor_callback_t f, void * arg);
+
+
+/*
+ * Return the 'n' most recent sensor measurements of sensor 'id', newest first
+ * Runs a prepared statement on the (sensor_id, timestamp) index
+ * The callback function is applied to every row in the result until it returns non-zero
+ * Return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_latest(DBCONN * conn, sensor_id_t id, int n, sensor_callback_t f, void * arg);
+
+
+/*
+ * Open a cursor over the sensor measurements selected by 'query', the statement is stepped as the rows are fetched
+ * so memory stays flat however many rows match. The cursor has its own statement, several can be open at once
+ * Return the cursor for success, NULL if an error occurs
+ */
+DBCURSOR * open_sensor_cursor(DBCONN * conn, const db_query_t * query);
+
+
+/*
+ * Fetch the next rows of 'cursor' as readings into 'rows', at most 'max' of them, the number is returned in '*count'
+ * '*count' is zero once all rows are fetched
+ * Return zero for success, and non-zero if an error occurs
+ */
+int fetch_sensor_cursor(DBCURSOR * cursor, sensor_data_t * rows, size_t max, size_t * count);
+
+
+/*
+ * Close 'cursor', also before all rows are fetched, and set '*cursor' to NULL
+ */
+void close_sensor_cursor(DBCURSOR ** cursor);
+
 #endif /* _SENSOR_DB_H_ */
 
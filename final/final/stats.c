@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stats.h"
+
+#define STATS_SKETCH_MIN_VALUE 1e-9 // magnitudes below this are counted as zero
+#define STATS_SKETCH_SLACK 8 // extra bins allocated when a store grows, so a slow drift doesn't reallocate per reading
+
+/*
+ * Window of the last readings that can still be the min (or max), values are monotonic from front to back
+ * 'seqs' holds the sequence number of every value, a value expires once it is 'window' readings old
+ */
+typedef struct {
+  sensor_value_t * values;
+  uint64_t * seqs;
+  uint16_t head;
+  uint16_t len;
+} stats_deque_t;
+
+// bins of one sign of a sketch, bins[i] counts the readings of key 'offset + i'
+typedef struct {
+  uint64_t * bins;
+  int32_t offset;
+  uint32_t len;
+} qsketch_store_t;
+
+struct qsketch {
+  qsketch_store_t pos; // keys of the positive readings
+  qsketch_store_t neg; // keys of the magnitude of the negative readings
+  uint64_t zero;
+  uint64_t count;
+};
+
+struct stats {
+  unsigned mask;
+  uint16_t window;
+  uint64_t seq; // readings added
+  stats_deque_t min;
+  stats_deque_t max;
+  double mean; // Welford
+  double m2;
+  double alpha;
+  double ewma;
+  qsketch_t * sketch;
+};
+
+static const struct {
+  const char * name;
+  unsigned mask;
+} stats_names[] = {
+  {"minmax", STATS_MINMAX},
+  {"variance", STATS_VARIANCE},
+  {"ewma", STATS_EWMA},
+  {"quantiles", STATS_QUANTILES},
+  {"all", STATS_ALL},
+  {"none", 0},
+};
+
+int stats_parse(const char * list, unsigned * mask)
+{
+  unsigned parsed = 0;
+  while (*list != '\0')
+  {
+    size_t len = strcspn(list, ",");
+    size_t i = 0;
+    while (i < sizeof(stats_names) / sizeof(stats_names[0]) &&
+           (strlen(stats_names[i].name) != len || strncmp(stats_names[i].name, list, len) != 0))
+      i++;
+    if (i == sizeof(stats_names) / sizeof(stats_names[0])) return STATS_FAILURE;
+    parsed |= stats_names[i].mask;
+    list += len;
+    if (*list == ',') list++;
+  }
+  *mask = parsed;
+  return STATS_SUCCESS;
+}
+
+
+/*
+ * Quantile sketch : a reading v is counted in bin ceil(log_gamma(|v|)) with gamma = (1 + a) / (1 - a),
+ * every value in a bin is within relative error a of the bin's representative value
+ * Sketches with the same accuracy merge by adding their bins
+ */
+static double qsketch_log_gamma()
+{
+  static double log_gamma = 0;
+  if (log_gamma == 0) log_gamma = log((1 + STATS_SKETCH_ACCURACY) / (1 - STATS_SKETCH_ACCURACY));
+  return log_gamma;
+}
+
+static int32_t qsketch_key(double magnitude)
+{
+  return (int32_t)ceil(log(magnitude) / qsketch_log_gamma());
+}
+
+// representative value of 'key', the relative error is the same to both ends of the bin
+static double qsketch_value(int32_t key)
+{
+  double gamma = exp(qsketch_log_gamma());
+  return 2 * exp(key * qsketch_log_gamma()) / (gamma + 1);
+}
+
+// counts 'n' readings in bin 'key', the store grows to cover it and collapses its lowest keys beyond STATS_SKETCH_MAX_BINS
+static int qsketch_store_add(qsketch_store_t * store, int32_t key, uint64_t n)
+{
+  int64_t low = store->offset, high = (int64_t)store->offset + store->len - 1;
+  if (store->len == 0)
+  {
+    low = high = key;
+  }
+  else if (key < low)
+  {
+    low = (int64_t)key - STATS_SKETCH_SLACK;
+  }
+  else if (key > high)
+  {
+    high = (int64_t)key + STATS_SKETCH_SLACK;
+  }
+  if (high - low + 1 > STATS_SKETCH_MAX_BINS) low = high - STATS_SKETCH_MAX_BINS + 1;
+  if (key < low) key = low;
+  if (store->len == 0 || low != store->offset || high != (int64_t)store->offset + store->len - 1)
+  {
+    uint32_t len = high - low + 1;
+    uint64_t * bins = calloc(len, sizeof(uint64_t));
+    if (bins == NULL) return STATS_FAILURE;
+    for (uint32_t i = 0; i < store->len; i++)
+    {
+      int64_t k = (int64_t)store->offset + i;
+      bins[(k < low ? low : k) - low] += store->bins[i];
+    }
+    free(store->bins);
+    store->bins = bins;
+    store->offset = low;
+    store->len = len;
+  }
+  store->bins[key - store->offset] += n;
+  return STATS_SUCCESS;
+}
+
+int qsketch_create(qsketch_t ** sketch)
+{
+  *sketch = calloc(1, sizeof(qsketch_t));
+  return *sketch != NULL ? STATS_SUCCESS : STATS_FAILURE;
+}
+
+void qsketch_free(qsketch_t ** sketch)
+{
+  if (sketch == NULL || *sketch == NULL) return;
+  free((*sketch)->pos.bins);
+  free((*sketch)->neg.bins);
+  free(*sketch);
+  *sketch = NULL;
+}
+
+static int qsketch_add(qsketch_t * sketch, double value)
+{
+  int ret = STATS_SUCCESS;
+  if (value > STATS_SKETCH_MIN_VALUE) ret = qsketch_store_add(&sketch->pos, qsketch_key(value), 1);
+  else if (value < -STATS_SKETCH_MIN_VALUE) ret = qsketch_store_add(&sketch->neg, qsketch_key(-value), 1);
+  else sketch->zero++;
+  if (ret == STATS_SUCCESS) sketch->count++;
+  return ret;
+}
+
+int qsketch_merge(qsketch_t * dst, const qsketch_t * src)
+{
+  for (uint32_t i = 0; i < src->pos.len; i++)
+  {
+    if (src->pos.bins[i] != 0 && qsketch_store_add(&dst->pos, src->pos.offset + i, src->pos.bins[i]) != STATS_SUCCESS)
+      return STATS_FAILURE;
+  }
+  for (uint32_t i = 0; i < src->neg.len; i++)
+  {
+    if (src->neg.bins[i] != 0 && qsketch_store_add(&dst->neg, src->neg.offset + i, src->neg.bins[i]) != STATS_SUCCESS)
+      return STATS_FAILURE;
+  }
+  dst->zero += src->zero;
+  dst->count += src->count;
+  return STATS_SUCCESS;
+}
+
+double qsketch_quantile(const qsketch_t * sketch, double q)
+{
+  if (sketch == NULL || sketch->count == 0 || !(q >= 0 && q <= 1)) return NAN;
+  uint64_t rank = (uint64_t)(q * (sketch->count - 1)), seen = 0;
+  // most negative first: the highest keys of the negative store
+  for (int64_t i = (int64_t)sketch->neg.len - 1; i >= 0; i--)
+  {
+    seen += sketch->neg.bins[i];
+    if (seen > rank) return -qsketch_value(sketch->neg.offset + i);
+  }
+  seen += sketch->zero;
+  if (seen > rank) return 0;
+  for (uint32_t i = 0; i < sketch->pos.len; i++)
+  {
+    seen += sketch->pos.bins[i];
+    if (seen > rank) return qsketch_value(sketch->pos.offset + i);
+  }
+  return qsketch_value(sketch->pos.offset + sketch->pos.len - 1);
+}
+
+
+/*
+ * Sliding min / max : every reading is pushed once and popped at most once
+ * 'is_min' keeps increasing values (front is the min), otherwise decreasing ones (front is the max)
+ */
+static void stats_deque_push(stats_deque_t * deque, uint16_t window, sensor_value_t value, uint64_t seq, int is_min)
+{
+  // values that are worse than the new one can never be the result again
+  while (deque->len > 0)
+  {
+    uint16_t back = (deque->head + deque->len - 1) % window;
+    if (is_min ? deque->values[back] < value : deque->values[back] > value) break;
+    deque->len--;
+  }
+  // the front leaves the window
+  while (deque->len > 0 && deque->seqs[deque->head] + window <= seq)
+  {
+    deque->head = (deque->head + 1) % window;
+    deque->len--;
+  }
+  uint16_t slot = (deque->head + deque->len) % window;
+  deque->values[slot] = value;
+  deque->seqs[slot] = seq;
+  deque->len++;
+}
+
+static int stats_deque_init(stats_deque_t * deque, uint16_t window)
+{
+  deque->values = malloc(window * sizeof(sensor_value_t));
+  deque->seqs = malloc(window * sizeof(uint64_t));
+  return deque->values != NULL && deque->seqs != NULL ? STATS_SUCCESS : STATS_FAILURE;
+}
+
+int stats_create(stats_t ** stats, unsigned mask, uint16_t window, double alpha)
+{
+  if (stats == NULL) return STATS_FAILURE;
+  *stats = NULL;
+  if (window == 0 || !(alpha > 0 && alpha <= 1)) return STATS_FAILURE;
+  stats_t * new_stats = calloc(1, sizeof(stats_t));
+  if (new_stats == NULL) return STATS_FAILURE;
+  new_stats->mask = mask;
+  new_stats->window = window;
+  new_stats->alpha = alpha;
+  if (((mask & STATS_MINMAX) &&
+       (stats_deque_init(&new_stats->min, window) != STATS_SUCCESS || stats_deque_init(&new_stats->max, window) != STATS_SUCCESS)) ||
+      ((mask & STATS_QUANTILES) && qsketch_create(&new_stats->sketch) != STATS_SUCCESS))
+  {
+    stats_free(&new_stats);
+    return STATS_FAILURE;
+  }
+  *stats = new_stats;
+  return STATS_SUCCESS;
+}
+
+void stats_free(stats_t ** stats)
+{
+  if (stats == NULL || *stats == NULL) return;
+  free((*stats)->min.values);
+  free((*stats)->min.seqs);
+  free((*stats)->max.values);
+  free((*stats)->max.seqs);
+  qsketch_free(&(*stats)->sketch);
+  free(*stats);
+  *stats = NULL;
+}
+
+void stats_add(stats_t * stats, sensor_value_t value)
+{
+  uint64_t seq = stats->seq++;
+  if (stats->mask & STATS_MINMAX)
+  {
+    stats_deque_push(&stats->min, stats->window, value, seq, 1);
+    stats_deque_push(&stats->max, stats->window, value, seq, 0);
+  }
+  if (stats->mask & STATS_VARIANCE)
+  {
+    double delta = value - stats->mean;
+    stats->mean += delta / stats->seq;
+    stats->m2 += delta * (value - stats->mean);
+  }
+  if (stats->mask & STATS_EWMA)
+    stats->ewma = seq == 0 ? value : stats->ewma + stats->alpha * (value - stats->ewma);
+  // a reading the sketch can't grow for is left out of the quantiles
+  if (stats->mask & STATS_QUANTILES) qsketch_add(stats->sketch, value);
+}
+
+unsigned stats_mask(const stats_t * stats)
+{
+  return stats != NULL ? stats->mask : 0;
+}
+
+double stats_get_min(const stats_t * stats)
+{
+  if (!(stats_mask(stats) & STATS_MINMAX) || stats->seq == 0) return NAN;
+  return stats->min.values[stats->min.head];
+}
+
+double stats_get_max(const stats_t * stats)
+{
+  if (!(stats_mask(stats) & STATS_MINMAX) || stats->seq == 0) return NAN;
+  return stats->max.values[stats->max.head];
+}
+
+double stats_get_mean(const stats_t * stats)
+{
+  if (!(stats_mask(stats) & STATS_VARIANCE) || stats->seq == 0) return NAN;
+  return stats->mean;
+}
+
+double stats_get_variance(const stats_t * stats)
+{
+  if (!(stats_mask(stats) & STATS_VARIANCE) || stats->seq < 2) return NAN;
+  return stats->m2 / (stats->seq - 1);
+}
+
+double stats_get_ewma(const stats_t * stats)
+{
+  if (!(stats_mask(stats) & STATS_EWMA) || stats->seq == 0) return NAN;
+  return stats->ewma;
+}
+
+double stats_get_quantile(const stats_t * stats, double q)
+{
+  if (!(stats_mask(stats) & STATS_QUANTILES)) return NAN;
+  return qsketch_quantile(stats->sketch, q);
+}
+
+const qsketch_t * stats_sketch(const stats_t * stats)
+{
+  return (stats_mask(stats) & STATS_QUANTILES) ? stats->sketch : NULL;
+}
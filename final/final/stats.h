@@ -0,0 +1,118 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+#define STATS_FAILURE -1
+#define STATS_SUCCESS 0
+
+/*
+ * Statistics a stats_t keeps, every one of them costs amortized O(1) per reading and only what is enabled is allocated
+ * STATS_MINMAX : min and max of the last 'window' readings, monotonic deques
+ * STATS_VARIANCE : mean and variance of all readings, Welford's update
+ * STATS_EWMA : exponentially weighted moving average
+ * STATS_QUANTILES : mergeable quantile sketch with STATS_SKETCH_ACCURACY relative error (DDSketch style)
+ */
+#define STATS_MINMAX 0x01
+#define STATS_VARIANCE 0x02
+#define STATS_EWMA 0x04
+#define STATS_QUANTILES 0x08
+#define STATS_ALL (STATS_MINMAX | STATS_VARIANCE | STATS_EWMA | STATS_QUANTILES)
+
+#ifndef STATS_SKETCH_ACCURACY
+  #define STATS_SKETCH_ACCURACY 0.01 // relative error of a quantile
+#endif
+
+#ifndef STATS_SKETCH_MAX_BINS
+  #define STATS_SKETCH_MAX_BINS 1024 // bins of one sign at most, the lowest are collapsed beyond it
+#endif
+
+typedef struct stats stats_t;
+
+typedef struct qsketch qsketch_t;
+
+
+/*
+ * Parses a comma separated list of "minmax", "variance", "ewma", "quantiles", or "all" / "none", into '*mask'
+ * Returns STATS_SUCCESS on success and STATS_FAILURE for an unknown name
+ */
+int stats_parse(const char * list, unsigned * mask);
+
+
+/*
+ * Allocates the statistics in 'mask', min/max over the last 'window' readings and an EWMA with weight 'alpha' (0 < alpha <= 1)
+ * Returns STATS_SUCCESS on success and STATS_FAILURE if an error occured
+ */
+int stats_create(stats_t ** stats, unsigned mask, uint16_t window, double alpha);
+
+
+/*
+ * Frees 'stats' and sets '*stats' to NULL
+ */
+void stats_free(stats_t ** stats);
+
+
+/*
+ * Adds 'value' to every enabled statistic
+ */
+void stats_add(stats_t * stats, sensor_value_t value);
+
+
+/*
+ * Returns the statistics enabled in 'stats'
+ */
+unsigned stats_mask(const stats_t * stats);
+
+
+/*
+ * The getters return NAN if the statistic isn't enabled or there is no reading yet
+ * stats_get_variance returns the sample variance, NAN below 2 readings
+ */
+double stats_get_min(const stats_t * stats);
+
+double stats_get_max(const stats_t * stats);
+
+double stats_get_mean(const stats_t * stats);
+
+double stats_get_variance(const stats_t * stats);
+
+double stats_get_ewma(const stats_t * stats);
+
+double stats_get_quantile(const stats_t * stats, double q);
+
+
+/*
+ * Returns the quantile sketch of 'stats', NULL if STATS_QUANTILES isn't enabled
+ */
+const qsketch_t * stats_sketch(const stats_t * stats);
+
+
+/*
+ * Allocates an empty quantile sketch
+ * Returns STATS_SUCCESS on success and STATS_FAILURE if an error occured
+ */
+int qsketch_create(qsketch_t ** sketch);
+
+
+/*
+ * Frees 'sketch' and sets '*sketch' to NULL
+ */
+void qsketch_free(qsketch_t ** sketch);
+
+
+/*
+ * Adds every reading counted in 'src' to 'dst', the result is the sketch of both inputs together
+ * Returns STATS_SUCCESS on success and STATS_FAILURE if an error occured
+ */
+int qsketch_merge(qsketch_t * dst, const qsketch_t * src);
+
+
+/*
+ * Returns the 'q' quantile (0 <= q <= 1) of the readings in 'sketch', NAN if it is empty
+ */
+double qsketch_quantile(const qsketch_t * sketch, double q);
+
+
+#endif  //_STATS_H_
@@ -0,0 +1,708 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "storage.h"
+#include "tsstore.h"
+#include "logger.h"
+#include "timeutil.h"
+
+#define LOG_MAX_LEN 1024
+// bytes of one reading in the sensor_data file format: <sensor_id><temperature><timestamp>
+#define BINLOG_RECORD_SIZE (sizeof(sensor_id_t) + sizeof(sensor_value_t) + sizeof(sensor_ts_t))
+#define JOURNAL_HEADER_SIZE sizeof(uint64_t)
+#define CONNECT_POLL_MS 50 // a running reconnect is checked this often
+
+// connect_state of a sink, the connector thread opens the backend while it is CONNECT_BUSY
+#define CONNECT_IDLE 0
+#define CONNECT_BUSY 1
+#define CONNECT_OPENED 2
+#define CONNECT_FAILED 3
+
+
+/*
+ * Retry journal : readings the sink could not take, in the binlog record format after a header that holds
+ * the offset of the first record not replayed yet. It survives a restart and is replayed into the next sink
+ */
+typedef struct {
+  int fd; // -1 without journal
+  uint64_t read_off; // next record to replay
+  uint64_t write_off; // end of the last complete record
+  unsigned char * buf; // STORAGE_BATCH_ROWS records in file format
+} storage_journal_t;
+
+struct storage_sink {
+  const storage_sink_ops_t * ops;
+  void * state;
+  char * target; // kept to reopen the sink
+  int connected;
+  unsigned opens; // successful opens so far
+  int backoff_ms; // delay before the next reconnect attempt after this one
+  int64_t retry_ms; // monotonic time of the next reconnect attempt
+  int connecting; // an open runs on the connector thread, reader side copy of connect_state
+  int connector_started; // reconnects are opened inline without the connector thread
+  pthread_t connector;
+  pthread_mutex_t connect_mutex; // protects connect_state and connect_stop
+  pthread_cond_t connect_cond;
+  int connect_state;
+  int connect_stop;
+  storage_journal_t journal;
+  storage_filter_t filter; // NULL stores every reading
+  storage_stats_t stats;
+};
+
+
+/*
+ * sqlite : one transaction per batch through the prepared insert
+ */
+static int sqlite_open(storage_sink_t * sink, const char * target)
+{
+  db_profile_t profile = DB_DEFAULT_PROFILE;
+  if (target != NULL && db_profile_from_name(target, &profile) != 0) return STORAGE_FAILURE;
+  // a reconnect keeps the readings stored before the outage
+  sink->state = init_connection_profile(sink->opens == 0, profile);
+  return sink->state != NULL ? STORAGE_SUCCESS : STORAGE_FAILURE;
+}
+
+static int sqlite_write_batch(storage_sink_t * sink, const sensor_data_t * data, size_t count)
+{
+  return insert_sensor_batch(sink->state, data, count) == 0 ? STORAGE_SUCCESS : STORAGE_FAILURE;
+}
+
+static int sqlite_flush(storage_sink_t * sink)
+{
+  return STORAGE_SUCCESS; // every batch is committed
+}
+
+static void sqlite_close(storage_sink_t * sink)
+{
+  disconnect(sink->state);
+}
+
+static const storage_sink_ops_t sqlite_ops = {"sqlite", sqlite_open, sqlite_write_batch, sqlite_flush, sqlite_close, NULL};
+
+
+/*
+ * binlog : readings appended to a file in the sensor_data format of file_creator
+ */
+typedef struct {
+  FILE * fp;
+  unsigned char * buf; // one batch in file format
+  uint64_t bytes;
+} binlog_state_t;
+
+// encodes 'count' readings into 'buf' in file format
+static void binlog_encode(unsigned char * buf, const sensor_data_t * data, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    memcpy(buf, &data[i].id, sizeof(data[i].id));
+    buf += sizeof(data[i].id);
+    memcpy(buf, &data[i].value, sizeof(data[i].value));
+    buf += sizeof(data[i].value);
+    memcpy(buf, &data[i].ts, sizeof(data[i].ts));
+    buf += sizeof(data[i].ts);
+  }
+}
+
+static void binlog_decode(sensor_data_t * data, const unsigned char * buf, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    memcpy(&data[i].id, buf, sizeof(data[i].id));
+    buf += sizeof(data[i].id);
+    memcpy(&data[i].value, buf, sizeof(data[i].value));
+    buf += sizeof(data[i].value);
+    memcpy(&data[i].ts, buf, sizeof(data[i].ts));
+    buf += sizeof(data[i].ts);
+  }
+}
+
+static int binlog_open(storage_sink_t * sink, const char * target)
+{
+  binlog_state_t * state = calloc(1, sizeof(binlog_state_t));
+  if (state == NULL) return STORAGE_FAILURE;
+  state->buf = malloc(STORAGE_BATCH_ROWS * BINLOG_RECORD_SIZE);
+  state->fp = fopen(target != NULL ? target : STORAGE_BINLOG_FILE, "ab");
+  if (state->buf == NULL || state->fp == NULL)
+  {
+    if (state->fp != NULL) fclose(state->fp);
+    free(state->buf);
+    free(state);
+    return STORAGE_FAILURE;
+  }
+  sink->state = state;
+  return STORAGE_SUCCESS;
+}
+
+static int binlog_write_batch(storage_sink_t * sink, const sensor_data_t * data, size_t count)
+{
+  binlog_state_t * state = sink->state;
+  while (count > 0)
+  {
+    size_t n = count < STORAGE_BATCH_ROWS ? count : STORAGE_BATCH_ROWS;
+    binlog_encode(state->buf, data, n);
+    if (fwrite(state->buf, BINLOG_RECORD_SIZE, n, state->fp) != n) return STORAGE_FAILURE;
+    state->bytes += n * BINLOG_RECORD_SIZE;
+    data += n;
+    count -= n;
+  }
+  return STORAGE_SUCCESS;
+}
+
+static int binlog_flush(storage_sink_t * sink)
+{
+  binlog_state_t * state = sink->state;
+  return fflush(state->fp) == 0 ? STORAGE_SUCCESS : STORAGE_FAILURE;
+}
+
+static void binlog_close(storage_sink_t * sink)
+{
+  binlog_state_t * state = sink->state;
+  fclose(state->fp);
+  free(state->buf);
+  free(state);
+}
+
+static void binlog_stats(storage_sink_t * sink, storage_stats_t * stats)
+{
+  stats->bytes = ((binlog_state_t *)sink->state)->bytes;
+}
+
+static const storage_sink_ops_t binlog_ops = {"binlog", binlog_open, binlog_write_batch, binlog_flush, binlog_close, binlog_stats};
+
+
+/*
+ * tsdb : the time-series segment store, readings are buffered in its open blocks until a flush
+ */
+static int tsdb_open(storage_sink_t * sink, const char * target)
+{
+  tsstore_t * store = NULL;
+  if (target == NULL || tsstore_open(&store, target) != TSSTORE_SUCCESS) return STORAGE_FAILURE;
+  sink->state = store;
+  return STORAGE_SUCCESS;
+}
+
+static int tsdb_write_batch(storage_sink_t * sink, const sensor_data_t * data, size_t count)
+{
+  return tsstore_append(sink->state, data, count) == TSSTORE_SUCCESS ? STORAGE_SUCCESS : STORAGE_FAILURE;
+}
+
+static int tsdb_flush(storage_sink_t * sink)
+{
+  return tsstore_flush(sink->state) == TSSTORE_SUCCESS ? STORAGE_SUCCESS : STORAGE_FAILURE;
+}
+
+static void tsdb_close(storage_sink_t * sink)
+{
+  tsstore_t * store = sink->state;
+  tsstore_close(&store);
+}
+
+static const storage_sink_ops_t tsdb_ops = {"tsdb", tsdb_open, tsdb_write_batch, tsdb_flush, tsdb_close, NULL};
+
+
+/*
+ * null : drops every reading, measures the pipeline without any storage cost
+ */
+static int null_open(storage_sink_t * sink, const char * target)
+{
+  return STORAGE_SUCCESS;
+}
+
+static int null_write_batch(storage_sink_t * sink, const sensor_data_t * data, size_t count)
+{
+  return STORAGE_SUCCESS;
+}
+
+static int null_flush(storage_sink_t * sink)
+{
+  return STORAGE_SUCCESS;
+}
+
+static void null_close(storage_sink_t * sink)
+{
+}
+
+static const storage_sink_ops_t null_ops = {"null", null_open, null_write_batch, null_flush, null_close, NULL};
+
+
+static const storage_sink_ops_t * storage_sinks[] = {&sqlite_ops, &binlog_ops, &tsdb_ops, &null_ops};
+
+// splits "<sink>[:<target>]", returns the sink operations or NULL for an unknown sink
+static const storage_sink_ops_t * storage_parse_spec(const char * spec, const char ** target)
+{
+  if (spec == NULL) return NULL;
+  const char * colon = strchr(spec, ':');
+  size_t len = colon != NULL ? (size_t)(colon - spec) : strlen(spec);
+  *target = colon != NULL && colon[1] != '\0' ? colon + 1 : NULL;
+  for (size_t i = 0; i < sizeof(storage_sinks) / sizeof(storage_sinks[0]); i++)
+  {
+    if (strlen(storage_sinks[i]->name) == len && strncmp(storage_sinks[i]->name, spec, len) == 0)
+      return storage_sinks[i];
+  }
+  return NULL;
+}
+
+int storage_valid_spec(const char * spec)
+{
+  const char * target;
+  const storage_sink_ops_t * ops = storage_parse_spec(spec, &target);
+  if (ops == NULL) return 0;
+  if (ops == &sqlite_ops && target != NULL)
+  {
+    db_profile_t profile;
+    return db_profile_from_name(target, &profile) == 0;
+  }
+  return ops != &tsdb_ops || target != NULL;
+}
+
+static int journal_reset(storage_journal_t * journal)
+{
+  uint64_t header = JOURNAL_HEADER_SIZE;
+  journal->read_off = journal->write_off = JOURNAL_HEADER_SIZE;
+  if (ftruncate(journal->fd, JOURNAL_HEADER_SIZE) != 0 ||
+      pwrite(journal->fd, &header, sizeof(header), 0) != sizeof(header)) return STORAGE_FAILURE;
+  return STORAGE_SUCCESS;
+}
+
+static int journal_open(storage_journal_t * journal, const char * path)
+{
+  struct stat st;
+  uint64_t header;
+  journal->buf = malloc(STORAGE_BATCH_ROWS * BINLOG_RECORD_SIZE);
+  journal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (journal->buf == NULL || journal->fd < 0 || fstat(journal->fd, &st) != 0)
+  {
+    if (journal->fd >= 0) close(journal->fd);
+    journal->fd = -1;
+    return STORAGE_FAILURE;
+  }
+  if ((uint64_t)st.st_size < JOURNAL_HEADER_SIZE || pread(journal->fd, &header, sizeof(header), 0) != sizeof(header))
+    return journal_reset(journal);
+  // a record torn by a crash is dropped, a header that doesn't point at a record replays everything
+  journal->write_off = JOURNAL_HEADER_SIZE + (st.st_size - JOURNAL_HEADER_SIZE) / BINLOG_RECORD_SIZE * BINLOG_RECORD_SIZE;
+  journal->read_off = header >= JOURNAL_HEADER_SIZE && header <= journal->write_off &&
+                      (header - JOURNAL_HEADER_SIZE) % BINLOG_RECORD_SIZE == 0 ? header : JOURNAL_HEADER_SIZE;
+  return STORAGE_SUCCESS;
+}
+
+// readings in the journal that were not replayed yet
+static uint64_t journal_pending(const storage_journal_t * journal)
+{
+  return journal->fd < 0 ? 0 : (journal->write_off - journal->read_off) / BINLOG_RECORD_SIZE;
+}
+
+// appends and syncs 'count' readings, fails if the journal would grow beyond STORAGE_JOURNAL_BYTES
+static int journal_append(storage_journal_t * journal, const sensor_data_t * data, size_t count)
+{
+  uint64_t offset = journal->write_off;
+  if (journal->fd < 0 || offset + count * BINLOG_RECORD_SIZE > STORAGE_JOURNAL_BYTES) return STORAGE_FAILURE;
+  while (count > 0)
+  {
+    size_t n = count < STORAGE_BATCH_ROWS ? count : STORAGE_BATCH_ROWS;
+    binlog_encode(journal->buf, data, n);
+    if (pwrite(journal->fd, journal->buf, n * BINLOG_RECORD_SIZE, offset) != (ssize_t)(n * BINLOG_RECORD_SIZE)) return STORAGE_FAILURE;
+    offset += n * BINLOG_RECORD_SIZE;
+    data += n;
+    count -= n;
+  }
+  if (fdatasync(journal->fd) != 0) return STORAGE_FAILURE;
+  journal->write_off = offset;
+  return STORAGE_SUCCESS;
+}
+
+// reads up to 'max' readings from the replay position, returns how many or -1 if an error occured
+static ssize_t journal_read(storage_journal_t * journal, sensor_data_t * data, size_t max)
+{
+  uint64_t offset = journal->read_off;
+  size_t total = 0, left = journal_pending(journal) < max ? journal_pending(journal) : max;
+  while (left > 0)
+  {
+    size_t n = left < STORAGE_BATCH_ROWS ? left : STORAGE_BATCH_ROWS;
+    if (pread(journal->fd, journal->buf, n * BINLOG_RECORD_SIZE, offset) != (ssize_t)(n * BINLOG_RECORD_SIZE)) return -1;
+    binlog_decode(data + total, journal->buf, n);
+    offset += n * BINLOG_RECORD_SIZE;
+    total += n;
+    left -= n;
+  }
+  return total;
+}
+
+// marks 'count' readings as replayed, the journal is emptied once everything is replayed
+static int journal_consume(storage_journal_t * journal, size_t count)
+{
+  journal->read_off += count * BINLOG_RECORD_SIZE;
+  if (journal->read_off == journal->write_off) return journal_reset(journal);
+  // not synced, a crash before the next sync only replays these readings again
+  return pwrite(journal->fd, &journal->read_off, sizeof(journal->read_off), 0) == sizeof(journal->read_off) ? STORAGE_SUCCESS : STORAGE_FAILURE;
+}
+
+static void journal_close(storage_journal_t * journal, const char * path)
+{
+  if (journal->fd >= 0)
+  {
+    if (journal_pending(journal) == 0) unlink(path);
+    close(journal->fd);
+  }
+  free(journal->buf);
+}
+
+// takes the result 'ret' of one attempt to (re)open the backend of 'sink', a failure schedules the next attempt with exponential backoff
+static void storage_connected(storage_sink_t * sink, int ret)
+{
+  char log_buf[LOG_MAX_LEN];
+  if (ret == STORAGE_SUCCESS)
+  {
+    if (sink->opens++ > 0)
+    {
+      sink->stats.reconnects++;
+      snprintf(log_buf, LOG_MAX_LEN, "Storage sink %s reconnected.\n", sink->ops->name);
+      log_event(log_buf);
+    }
+    sink->connected = 1;
+    return;
+  }
+  snprintf(log_buf, LOG_MAX_LEN, "Storage sink %s unavailable, next attempt in %d ms.\n", sink->ops->name, sink->backoff_ms);
+  log_event(log_buf);
+  sink->retry_ms = timeutil_now_ms() + sink->backoff_ms;
+  sink->backoff_ms = sink->backoff_ms < STORAGE_RETRY_MAX_MS / 2 ? sink->backoff_ms * 2 : STORAGE_RETRY_MAX_MS;
+}
+
+// connector thread of 'arg', opens the backend on request so a slow open doesn't stall the reader
+static void * storage_connector(void * arg)
+{
+  storage_sink_t * sink = arg;
+  pthread_mutex_lock(&sink->connect_mutex);
+  while (!sink->connect_stop)
+  {
+    if (sink->connect_state != CONNECT_BUSY)
+    {
+      pthread_cond_wait(&sink->connect_cond, &sink->connect_mutex);
+      continue;
+    }
+    pthread_mutex_unlock(&sink->connect_mutex);
+    int ret = sink->ops->open(sink, sink->target);
+    pthread_mutex_lock(&sink->connect_mutex);
+    sink->connect_state = ret == STORAGE_SUCCESS ? CONNECT_OPENED : CONNECT_FAILED;
+  }
+  pthread_mutex_unlock(&sink->connect_mutex);
+  return NULL;
+}
+
+// starts an open of a failed sink once its backoff is over and picks up the result of the last one
+// Returns 1 if the sink is connected again
+static int storage_reconnect(storage_sink_t * sink, int64_t now)
+{
+  int state;
+  if (!sink->connector_started)
+  {
+    if (now >= sink->retry_ms) storage_connected(sink, sink->ops->open(sink, sink->target));
+    return sink->connected;
+  }
+  pthread_mutex_lock(&sink->connect_mutex);
+  state = sink->connect_state;
+  if (state == CONNECT_IDLE && now >= sink->retry_ms)
+  {
+    sink->connect_state = CONNECT_BUSY;
+    pthread_cond_signal(&sink->connect_cond);
+  }
+  else if (state != CONNECT_BUSY)
+  {
+    sink->connect_state = CONNECT_IDLE;
+  }
+  sink->connecting = sink->connect_state == CONNECT_BUSY;
+  pthread_mutex_unlock(&sink->connect_mutex);
+  if (state == CONNECT_OPENED || state == CONNECT_FAILED)
+    storage_connected(sink, state == CONNECT_OPENED ? STORAGE_SUCCESS : STORAGE_FAILURE);
+  return sink->connected;
+}
+
+// stops the connector thread, a backend it opened meanwhile is closed again
+static void storage_connector_stop(storage_sink_t * sink)
+{
+  if (!sink->connector_started) return;
+  pthread_mutex_lock(&sink->connect_mutex);
+  sink->connect_stop = 1;
+  pthread_cond_signal(&sink->connect_cond);
+  pthread_mutex_unlock(&sink->connect_mutex);
+  // waits for an open that is still running
+  pthread_join(sink->connector, NULL);
+  if (sink->connect_state == CONNECT_OPENED) sink->ops->close(sink);
+  pthread_cond_destroy(&sink->connect_cond);
+  pthread_mutex_destroy(&sink->connect_mutex);
+  sink->connector_started = 0;
+}
+
+// closes the backend of a failed sink, readings go to the retry journal until it is reconnected
+static void storage_disconnect(storage_sink_t * sink)
+{
+  char log_buf[LOG_MAX_LEN];
+  snprintf(log_buf, LOG_MAX_LEN, "Storage sink %s failed, reconnecting in %d ms.\n", sink->ops->name, sink->backoff_ms);
+  log_event(log_buf);
+  sink->ops->close(sink);
+  sink->state = NULL;
+  sink->connected = 0;
+  sink->retry_ms = timeutil_now_ms() + sink->backoff_ms;
+  sink->backoff_ms = sink->backoff_ms < STORAGE_RETRY_MAX_MS / 2 ? sink->backoff_ms * 2 : STORAGE_RETRY_MAX_MS;
+}
+
+int storage_open(storage_sink_t ** sink, const char * spec)
+{
+  char log_buf[LOG_MAX_LEN];
+  const char * target;
+  if (sink == NULL) return STORAGE_FAILURE;
+  *sink = NULL;
+  const storage_sink_ops_t * ops = storage_parse_spec(spec, &target);
+  if (ops == NULL) return STORAGE_FAILURE;
+  storage_sink_t * new_sink = calloc(1, sizeof(storage_sink_t));
+  if (new_sink == NULL) return STORAGE_FAILURE;
+  new_sink->ops = ops;
+  new_sink->target = target != NULL ? strdup(target) : NULL;
+  new_sink->backoff_ms = STORAGE_RETRY_MIN_MS;
+  if (target != NULL && new_sink->target == NULL)
+  {
+    free(new_sink);
+    return STORAGE_FAILURE;
+  }
+  if (journal_open(&new_sink->journal, STORAGE_JOURNAL_FILE) != STORAGE_SUCCESS)
+  {
+    snprintf(log_buf, LOG_MAX_LEN, "Retry journal %s unavailable, a failed batch holds the storage manager back until the sink reconnects.\n", STORAGE_JOURNAL_FILE);
+    log_event(log_buf);
+  }
+  else if (journal_pending(&new_sink->journal) > 0)
+  {
+    snprintf(log_buf, LOG_MAX_LEN, "Retry journal %s holds %" PRIu64 " readings of an earlier run.\n", STORAGE_JOURNAL_FILE, journal_pending(&new_sink->journal));
+    log_event(log_buf);
+  }
+  // the first open runs inline, a sink that can't be opened yet is reconnected by storage_parse_sensor_data
+  storage_connected(new_sink, ops->open(new_sink, new_sink->target));
+  if (new_sink->connected)
+  {
+    snprintf(log_buf, LOG_MAX_LEN, "Storage sink %s opened.\n", spec);
+    log_event(log_buf);
+  }
+  // later opens run on the connector thread, or inline if it can't be started
+  if (pthread_mutex_init(&new_sink->connect_mutex, NULL) == 0)
+  {
+    if (pthread_cond_init(&new_sink->connect_cond, NULL) != 0)
+    {
+      pthread_mutex_destroy(&new_sink->connect_mutex);
+    }
+    else if (pthread_create(&new_sink->connector, NULL, storage_connector, new_sink) != 0)
+    {
+      pthread_cond_destroy(&new_sink->connect_cond);
+      pthread_mutex_destroy(&new_sink->connect_mutex);
+    }
+    else
+    {
+      new_sink->connector_started = 1;
+    }
+  }
+  *sink = new_sink;
+  return STORAGE_SUCCESS;
+}
+
+void storage_set_filter(storage_sink_t * sink, storage_filter_t filter)
+{
+  if (sink != NULL) sink->filter = filter;
+}
+
+// drops the readings of 'data' the filter of 'sink' rejects, returns how many are left
+static size_t storage_apply_filter(storage_sink_t * sink, sensor_data_t * data, size_t count)
+{
+  size_t kept = 0;
+  if (sink->filter == NULL) return count;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (sink->filter(data[i].id)) data[kept++] = data[i];
+  }
+  sink->stats.filtered += count - kept;
+  return kept;
+}
+
+int storage_write_batch(storage_sink_t * sink, const sensor_data_t * data, size_t count)
+{
+  if (sink == NULL || !sink->connected) return STORAGE_FAILURE;
+  if (sink->ops->write_batch(sink, data, count) != STORAGE_SUCCESS)
+  {
+    sink->stats.failures++;
+    return STORAGE_FAILURE;
+  }
+  sink->stats.rows += count;
+  sink->stats.batches++;
+  return STORAGE_SUCCESS;
+}
+
+int storage_flush(storage_sink_t * sink)
+{
+  if (sink == NULL || !sink->connected) return STORAGE_FAILURE;
+  if (sink->ops->flush(sink) != STORAGE_SUCCESS)
+  {
+    sink->stats.failures++;
+    return STORAGE_FAILURE;
+  }
+  return STORAGE_SUCCESS;
+}
+
+void storage_get_stats(storage_sink_t * sink, storage_stats_t * stats)
+{
+  *stats = sink->stats;
+  if (sink->connected && sink->ops->stats != NULL) sink->ops->stats(sink, stats);
+}
+
+void storage_close(storage_sink_t ** sink)
+{
+  char log_buf[LOG_MAX_LEN];
+  storage_stats_t stats;
+  if (sink == NULL || *sink == NULL) return;
+  storage_connector_stop(*sink);
+  storage_flush(*sink);
+  storage_get_stats(*sink, &stats);
+  snprintf(log_buf, LOG_MAX_LEN, "Storage sink %s closed: %" PRIu64 " readings in %" PRIu64 " batches, %" PRIu64 " failures, %" PRIu64 " bytes, %" PRIu64 " reconnects, %" PRIu64 " readings journaled, %" PRIu64 " filtered.\n",
+           (*sink)->ops->name, stats.rows, stats.batches, stats.failures, stats.bytes, stats.reconnects, stats.journaled, stats.filtered);
+  log_event(log_buf);
+  if (journal_pending(&(*sink)->journal) > 0)
+  {
+    snprintf(log_buf, LOG_MAX_LEN, "Retry journal %s keeps %" PRIu64 " readings for the next start.\n", STORAGE_JOURNAL_FILE, journal_pending(&(*sink)->journal));
+    log_event(log_buf);
+  }
+  if ((*sink)->connected) (*sink)->ops->close(*sink);
+  journal_close(&(*sink)->journal, STORAGE_JOURNAL_FILE);
+  free((*sink)->target);
+  free(*sink);
+  *sink = NULL;
+}
+
+// writes and flushes 'count' readings, a failure takes the sink down
+static int storage_store(storage_sink_t * sink, const sensor_data_t * data, size_t count)
+{
+  if (!sink->connected) return STORAGE_FAILURE;
+  if (storage_write_batch(sink, data, count) == STORAGE_SUCCESS && storage_flush(sink) == STORAGE_SUCCESS)
+  {
+    sink->backoff_ms = STORAGE_RETRY_MIN_MS;
+    return STORAGE_SUCCESS;
+  }
+  storage_disconnect(sink);
+  return STORAGE_FAILURE;
+}
+
+// replays one bulk batch of up to STORAGE_REPLAY_ROWS journaled readings, returns 1 if there was progress
+static int storage_replay(storage_sink_t * sink, sensor_data_t * buf)
+{
+  char log_buf[LOG_MAX_LEN];
+  ssize_t n = journal_read(&sink->journal, buf, STORAGE_REPLAY_ROWS);
+  if (n <= 0 || storage_store(sink, buf, n) != STORAGE_SUCCESS) return 0;
+  if (journal_consume(&sink->journal, n) != STORAGE_SUCCESS) return 0;
+  if (journal_pending(&sink->journal) == 0)
+  {
+    snprintf(log_buf, LOG_MAX_LEN, "Retry journal replayed to storage sink %s.\n", sink->ops->name);
+    log_event(log_buf);
+  }
+  return 1;
+}
+
+void storage_parse_sensor_data(storage_sink_t * sink, sbuffer_reader_t * reader)
+{
+  char log_buf[LOG_MAX_LEN];
+  int done = 0, blocked = 0;
+  sensor_data_t * pending, * replay;
+  size_t pending_len = 0, count;
+  int64_t first_ms = 0, hold_ms = 0;
+  if (sink == NULL || reader == NULL) return;
+  pending = malloc(STORAGE_BATCH_ROWS * sizeof(sensor_data_t));
+  replay = malloc(STORAGE_REPLAY_ROWS * sizeof(sensor_data_t));
+  if (pending == NULL || replay == NULL)
+  {
+    free(pending);
+    free(replay);
+    return;
+  }
+  while (!done)
+  {
+    int64_t now = timeutil_now_ms(), deadline = INT64_MAX;
+    int replayed = 0;
+    // a held back batch is retried as soon as the sink is back
+    if (!sink->connected && storage_reconnect(sink, now) && blocked) hold_ms = now;
+    if (sink->connected && journal_pending(&sink->journal) > 0) replayed = storage_replay(sink, replay);
+    // only wait as long as the open batch may still grow or is held back, the next reconnect is due
+    // or the journal has more to replay
+    if (pending_len > 0) deadline = blocked ? hold_ms : first_ms + STORAGE_BATCH_DELAY_MS;
+    if (!sink->connected)
+    {
+      int64_t next = sink->connecting ? now + CONNECT_POLL_MS : sink->retry_ms;
+      if (next < deadline) deadline = next;
+    }
+    if (replayed) deadline = now;
+    int timeout_ms = SBUFFER_WAIT_FOREVER;
+    if (deadline != INT64_MAX)
+    {
+      int64_t left = deadline - timeutil_now_ms();
+      timeout_ms = left > 0 ? (int)left : 0;
+    }
+    if (pending_len == STORAGE_BATCH_ROWS)
+    {
+      // the held back batch is full, leave the readings in the buffer until the next retry
+      struct timespec wait = {timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000};
+      nanosleep(&wait, NULL);
+    }
+    else
+    {
+      int ret = sbuffer_read_batch(reader, pending + pending_len, STORAGE_BATCH_ROWS - pending_len, &count, timeout_ms);
+      if (ret == SBUFFER_SUCCESS)
+      {
+        count = storage_apply_filter(sink, pending + pending_len, count);
+        if (pending_len == 0 && count > 0) first_ms = timeutil_now_ms();
+        pending_len += count;
+      }
+      else if (ret != SBUFFER_NO_DATA)
+      {
+        // closed or failed, store what is left
+        done = 1;
+      }
+    }
+    now = timeutil_now_ms();
+    if (pending_len == 0 ||
+        (!done && (blocked ? now < hold_ms : pending_len < STORAGE_BATCH_ROWS && now - first_ms < STORAGE_BATCH_DELAY_MS)))
+      continue;
+    // readings only bypass the journal once it is replayed, so they are stored in order
+    if (journal_pending(&sink->journal) == 0 && storage_store(sink, pending, pending_len) == STORAGE_SUCCESS)
+    {
+      pending_len = 0;
+      blocked = 0;
+    }
+    else if (journal_append(&sink->journal, pending, pending_len) == STORAGE_SUCCESS)
+    {
+      sink->stats.journaled += pending_len;
+      pending_len = 0;
+      blocked = 0;
+    }
+    else
+    {
+      // the batch keeps growing up to STORAGE_BATCH_ROWS and is retried every STORAGE_RETRY_MIN_MS
+      hold_ms = now + STORAGE_RETRY_MIN_MS;
+      if (!blocked)
+      {
+        snprintf(log_buf, LOG_MAX_LEN, "Retry journal %s full or unavailable, holding readings for storage sink %s.\n", STORAGE_JOURNAL_FILE, sink->ops->name);
+        log_event(log_buf);
+        blocked = 1;
+      }
+    }
+  }
+  // replay the rest while the sink is up, whatever fails stays in the journal for the next start
+  while (sink->connected && journal_pending(&sink->journal) > 0 && storage_replay(sink, replay));
+  if (pending_len > 0)
+  {
+    snprintf(log_buf, LOG_MAX_LEN, "Storage sink %s lost %zu readings.\n", sink->ops->name, pending_len);
+    log_event(log_buf);
+  }
+  free(pending);
+  free(replay);
+}
@@ -0,0 +1,134 @@
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+#include "sbuffer.h"
+#include "sensor_db.h"
+
+#define STORAGE_FAILURE -1
+#define STORAGE_SUCCESS 0
+
+#ifndef STORAGE_BATCH_ROWS
+  #define STORAGE_BATCH_ROWS DB_COMMIT_ROWS // readings handed to a sink in one write at most
+#endif
+
+#ifndef STORAGE_BATCH_DELAY_MS
+  #define STORAGE_BATCH_DELAY_MS DB_COMMIT_DELAY_MS // longest time a reading waits before it is written and flushed
+#endif
+
+#ifndef STORAGE_REPLAY_ROWS
+  #define STORAGE_REPLAY_ROWS (16 * STORAGE_BATCH_ROWS) // journaled readings replayed in one bulk write
+#endif
+
+#ifndef STORAGE_JOURNAL_BYTES
+  #define STORAGE_JOURNAL_BYTES (64 << 20) // the retry journal doesn't grow beyond this, about 3.7 million readings
+#endif
+
+#ifndef STORAGE_RETRY_MIN_MS
+  #define STORAGE_RETRY_MIN_MS 500 // first reconnect delay after a failure, doubled on every failed attempt
+#endif
+
+#ifndef STORAGE_RETRY_MAX_MS
+  #define STORAGE_RETRY_MAX_MS 30000 // longest reconnect delay
+#endif
+
+#define STORAGE_BINLOG_FILE "sensor_data_recv" // default file of the binlog sink
+#define STORAGE_JOURNAL_FILE "storage_retry.journal" // readings waiting for the sink to come back
+
+typedef struct storage_sink storage_sink_t;
+
+typedef struct {
+  uint64_t rows; // readings written
+  uint64_t batches; // successful write_batch calls
+  uint64_t failures; // failed write_batch and flush calls
+  uint64_t bytes; // bytes the sink wrote, 0 if it doesn't know
+  uint64_t reconnects; // successful reopens after a failure
+  uint64_t journaled; // readings spilled to the retry journal
+  uint64_t filtered; // readings the filter kept out of the sink
+} storage_stats_t;
+
+// returns 1 if the readings of sensor 'id' are stored, 0 to drop them
+typedef int (*storage_filter_t)(sensor_id_t id);
+
+/*
+ * Operations of one kind of sink, every sink keeps its own state in 'sink->state'
+ * open : connect to 'target' (sink specific, NULL selects the default), called again after close to reconnect
+ * write_batch : store 'count' readings, either all of them or none (as far as the sink can tell)
+ * flush : make everything written so far durable / visible
+ * close : flush and release the state
+ * stats : optional, adds the sink specific counters to 'stats'
+ */
+typedef struct {
+  const char * name;
+  int (*open)(storage_sink_t * sink, const char * target);
+  int (*write_batch)(storage_sink_t * sink, const sensor_data_t * data, size_t count);
+  int (*flush)(storage_sink_t * sink);
+  void (*close)(storage_sink_t * sink);
+  void (*stats)(storage_sink_t * sink, storage_stats_t * stats);
+} storage_sink_ops_t;
+
+/*
+ * Returns 1 if 'spec' names a known sink, 0 otherwise. A spec is "<sink>[:<target>]":
+ *   sqlite[:<profile>]   the SQLite database DB_NAME, with durability profile safe, balanced or fast
+ *   binlog[:<file>]      raw readings appended in the sensor_data file format (default STORAGE_BINLOG_FILE)
+ *   tsdb:<directory>     the time-series segment store
+ *   null                 counts the readings and drops them
+ */
+int storage_valid_spec(const char * spec);
+
+
+/*
+ * Opens the sink described by 'spec' and returns it as '*sink'
+ * A sink whose backend can't be opened yet is returned as well, storage_parse_sensor_data keeps reconnecting it
+ * Returns STORAGE_SUCCESS on success and STORAGE_FAILURE if 'spec' is invalid or an error occured
+ */
+int storage_open(storage_sink_t ** sink, const char * spec);
+
+
+/*
+ * Makes storage_parse_sensor_data store only the readings 'filter' accepts, NULL stores every reading
+ */
+void storage_set_filter(storage_sink_t * sink, storage_filter_t filter);
+
+
+/*
+ * Writes the 'count' readings in 'data' to 'sink'
+ * Returns STORAGE_SUCCESS on success and STORAGE_FAILURE if an error occured, nothing is written then
+ */
+int storage_write_batch(storage_sink_t * sink, const sensor_data_t * data, size_t count);
+
+
+/*
+ * Makes everything written to 'sink' so far durable
+ * Returns STORAGE_SUCCESS on success and STORAGE_FAILURE if an error occured
+ */
+int storage_flush(storage_sink_t * sink);
+
+
+/*
+ * Returns the counters of 'sink' in '*stats'
+ */
+void storage_get_stats(storage_sink_t * sink, storage_stats_t * stats);
+
+
+/*
+ * Flushes and closes 'sink', logs its counters and sets '*sink' to NULL
+ */
+void storage_close(storage_sink_t ** sink);
+
+
+/*
+* Reads continiously all data from the shared buffer data structure through 'reader' and writes it to 'sink'
+* Readings are written in batches of up to STORAGE_BATCH_ROWS, at most STORAGE_BATCH_DELAY_MS after they were read
+* A batch the sink fails to store goes to the retry journal STORAGE_JOURNAL_FILE and the sink is reopened on a helper thread
+* with exponential backoff, reading from the buffer goes on meanwhile. Once the sink is back the journal is replayed
+* in bulk batches of STORAGE_REPLAY_ROWS before new readings are written. The buffer is only held back when the journal is full
+* or unavailable, the batch is retried every STORAGE_RETRY_MIN_MS then and as soon as the sink is back
+* When no more data arrives the method finishes. This method will NOT automatically close the sink
+*/
+void storage_parse_sensor_data(storage_sink_t * sink, sbuffer_reader_t * reader);
+
+
+#endif  //_STORAGE_H_
@@ -0,0 +1,19 @@
+#ifndef _TIMEUTIL_H_
+#define _TIMEUTIL_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Returns milliseconds on the monotonic clock, for deadlines and timeouts that must not jump with the wall clock
+ * Needs clock_gettime, the including file defines _GNU_SOURCE (or a POSIX level) before its first include
+ */
+static inline int64_t timeutil_now_ms(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+#endif  //_TIMEUTIL_H_
@@ -0,0 +1,628 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "tsstore.h"
+
+#define TSSTORE_BLOCK_MAGIC 0x31425354 // "TSB1"
+#define TSSTORE_READING_BITS (4 + 64 + 2 + 5 + 6 + 64) // longest encoding of one reading
+#define TSSTORE_BLOCK_BYTES ((64 + (TSSTORE_BLOCK_READINGS - 1) * TSSTORE_READING_BITS + 7) / 8) // longest payload of a block
+
+/*
+ * Header in front of every block of a segment
+ * The payload is written before the header, so a torn write of the open block leaves the previous
+ * header in place, which still describes a valid prefix of the (append-only) bit stream
+ */
+typedef struct tsstore_block_header {
+  uint32_t magic;
+  uint32_t count; // readings in the block
+  int64_t first_ts; // timestamp of the first reading, the others are encoded relative to it
+  int64_t min_ts; // time range of the block
+  int64_t max_ts;
+  uint32_t nbytes; // payload bytes after the header
+  uint32_t reserved;
+} tsstore_block_header_t;
+
+// entry of the sparse time index, one per sealed block
+typedef struct tsstore_index_entry {
+  int64_t min_ts;
+  int64_t max_ts;
+  uint64_t offset; // of the block header in the segment
+  uint64_t size; // header and payload
+} tsstore_index_entry_t;
+
+// bit stream of one block, most significant bit first
+typedef struct tsstore_bits {
+  uint8_t * buf;
+  size_t cap; // bytes allocated, all zero behind 'pos'
+  size_t pos; // bits written or read so far
+} tsstore_bits_t;
+
+// state carried from one reading to the next, the decoder rebuilds the same state
+typedef struct tsstore_codec {
+  int64_t prev_ts;
+  int64_t prev_delta;
+  uint64_t prev_value;
+  int prev_lead; // leading and trailing zeros of the last XOR written with its own window, -1 if none yet
+  int prev_trail;
+} tsstore_codec_t;
+
+// a full block, written and indexed by the next flush
+typedef struct tsstore_sealed {
+  tsstore_block_header_t hdr;
+  uint8_t * buf; // TSSTORE_BLOCK_BYTES, all zero behind the payload
+  struct tsstore_sealed * next;
+} tsstore_sealed_t;
+
+typedef struct tsstore_series {
+  sensor_id_t id;
+  int seq; // segment being written
+  uint64_t seg_size; // bytes of sealed blocks in the segment, the open block is written behind them
+  int seg_fd; // files of segment 'seq' while the series is in the open list, -1 otherwise
+  int idx_fd;
+  tsstore_block_header_t hdr; // of the open block
+  tsstore_bits_t bits; // payload of the open block
+  tsstore_codec_t codec;
+  tsstore_sealed_t * sealed; // blocks to write on the next flush, oldest first
+  tsstore_sealed_t ** sealed_tail;
+  tsstore_sealed_t * spare; // buffers for the blocks the current append seals
+  uint32_t batch_count; // readings of the series in the current append
+  bool dirty; // the open block changed since the last flush
+  struct tsstore_series * next_dirty;
+  struct tsstore_series * next_batch; // series of the current append
+  struct tsstore_series * open_prev; // open list, most recently written first
+  struct tsstore_series * open_next;
+} tsstore_series_t;
+
+struct tsstore {
+  char * dir;
+  tsstore_series_t * dirty; // series to write on the next flush
+  tsstore_series_t * open_head; // series with open files, at most TSSTORE_OPEN_SERIES
+  tsstore_series_t * open_tail;
+  int open_count;
+  tsstore_series_t * series[UINT16_MAX + 1]; // indexed by sensor id, allocated on the first reading
+};
+
+
+static void tsstore_path(const char * dir, sensor_id_t id, int seq, const char * ext, char * path)
+{
+  snprintf(path, PATH_MAX, "%s/%u_%d.%s", dir, id, seq, ext);
+}
+
+// append the 'n' low bits of 'value'
+static int tsstore_bits_write(tsstore_bits_t * bits, uint64_t value, int n)
+{
+  if ((bits->pos + n + 7) / 8 > bits->cap)
+  {
+    size_t cap = bits->cap ? bits->cap * 2 : 64;
+    uint8_t * buf = realloc(bits->buf, cap);
+    if (buf == NULL) return TSSTORE_FAILURE;
+    memset(buf + bits->cap, 0, cap - bits->cap);
+    bits->buf = buf;
+    bits->cap = cap;
+  }
+  while (n > 0)
+  {
+    int room = 8 - (bits->pos & 7);
+    int take = n < room ? n : room;
+    uint8_t chunk = (value >> (n - take)) & ((1u << take) - 1);
+    bits->buf[bits->pos >> 3] |= chunk << (room - take);
+    bits->pos += take;
+    n -= take;
+  }
+  return TSSTORE_SUCCESS;
+}
+
+// read 'n' bits, reading past the end moves 'pos' beyond the stream so the caller can detect it
+static uint64_t tsstore_bits_read(tsstore_bits_t * bits, int n)
+{
+  uint64_t value = 0;
+  while (n > 0)
+  {
+    if ((bits->pos >> 3) >= bits->cap)
+    {
+      bits->pos += n;
+      return 0;
+    }
+    int room = 8 - (bits->pos & 7);
+    int take = n < room ? n : room;
+    uint8_t byte = bits->buf[bits->pos >> 3];
+    value = (value << take) | ((byte >> (room - take)) & ((1u << take) - 1));
+    bits->pos += take;
+    n -= take;
+  }
+  return value;
+}
+
+/*
+ * Encodes one reading behind the previous one of the block
+ * timestamp : delta-of-delta, '0' | '10'+7 bits | '110'+9 bits | '1110'+12 bits | '1111'+64 bits
+ * value : XOR with the previous value, '0' when equal, '10' + the bits inside the previous window,
+ *         '11' + 5 bits leading zeros + 6 bits length + the meaningful bits otherwise
+ * The first reading of a block only stores its value, its timestamp is in the block header
+ */
+static int tsstore_encode(tsstore_bits_t * bits, tsstore_codec_t * codec, const sensor_data_t * data, bool first)
+{
+  uint64_t value;
+  int ret = TSSTORE_SUCCESS;
+  memcpy(&value, &data->value, sizeof(value));
+  if (first)
+  {
+    codec->prev_ts = data->ts;
+    codec->prev_delta = 0;
+    codec->prev_value = value;
+    codec->prev_lead = -1;
+    return tsstore_bits_write(bits, value, 64);
+  }
+
+  int64_t delta = (int64_t)data->ts - codec->prev_ts;
+  int64_t dod = delta - codec->prev_delta;
+  if (dod == 0)
+    ret |= tsstore_bits_write(bits, 0x0, 1);
+  else if (dod >= -63 && dod <= 64)
+    ret |= tsstore_bits_write(bits, 0x2, 2) | tsstore_bits_write(bits, dod + 63, 7);
+  else if (dod >= -255 && dod <= 256)
+    ret |= tsstore_bits_write(bits, 0x6, 3) | tsstore_bits_write(bits, dod + 255, 9);
+  else if (dod >= -2047 && dod <= 2048)
+    ret |= tsstore_bits_write(bits, 0xE, 4) | tsstore_bits_write(bits, dod + 2047, 12);
+  else
+    ret |= tsstore_bits_write(bits, 0xF, 4) | tsstore_bits_write(bits, (uint64_t)dod, 64);
+
+  uint64_t xor = value ^ codec->prev_value;
+  if (xor == 0)
+    ret |= tsstore_bits_write(bits, 0x0, 1);
+  else
+  {
+    int lead = __builtin_clzll(xor);
+    int trail = __builtin_ctzll(xor);
+    if (lead > 31) lead = 31; // 5 bits
+    if (codec->prev_lead >= 0 && lead >= codec->prev_lead && trail >= codec->prev_trail)
+    {
+      ret |= tsstore_bits_write(bits, 0x2, 2);
+      ret |= tsstore_bits_write(bits, xor >> codec->prev_trail, 64 - codec->prev_lead - codec->prev_trail);
+    }
+    else
+    {
+      int len = 64 - lead - trail;
+      ret |= tsstore_bits_write(bits, 0x3, 2) | tsstore_bits_write(bits, lead, 5);
+      ret |= tsstore_bits_write(bits, len - 1, 6) | tsstore_bits_write(bits, xor >> trail, len);
+      codec->prev_lead = lead;
+      codec->prev_trail = trail;
+    }
+  }
+  codec->prev_ts = data->ts;
+  codec->prev_delta = delta;
+  codec->prev_value = value;
+  return ret == TSSTORE_SUCCESS ? TSSTORE_SUCCESS : TSSTORE_FAILURE;
+}
+
+// decodes the next reading of a block, returns TSSTORE_FAILURE when the stream is damaged
+static int tsstore_decode(tsstore_bits_t * bits, tsstore_codec_t * codec, const tsstore_block_header_t * hdr,
+                          sensor_data_t * data, bool first)
+{
+  if (first)
+  {
+    codec->prev_ts = hdr->first_ts;
+    codec->prev_delta = 0;
+    codec->prev_value = tsstore_bits_read(bits, 64);
+    codec->prev_lead = -1;
+  }
+  else
+  {
+    int64_t dod;
+    if (tsstore_bits_read(bits, 1) == 0)
+      dod = 0;
+    else if (tsstore_bits_read(bits, 1) == 0)
+      dod = (int64_t)tsstore_bits_read(bits, 7) - 63;
+    else if (tsstore_bits_read(bits, 1) == 0)
+      dod = (int64_t)tsstore_bits_read(bits, 9) - 255;
+    else if (tsstore_bits_read(bits, 1) == 0)
+      dod = (int64_t)tsstore_bits_read(bits, 12) - 2047;
+    else
+      dod = (int64_t)tsstore_bits_read(bits, 64);
+    codec->prev_delta += dod;
+    codec->prev_ts += codec->prev_delta;
+
+    if (tsstore_bits_read(bits, 1) == 1)
+    {
+      if (tsstore_bits_read(bits, 1) == 1)
+      {
+        codec->prev_lead = tsstore_bits_read(bits, 5);
+        int len = tsstore_bits_read(bits, 6) + 1;
+        codec->prev_trail = 64 - codec->prev_lead - len;
+        if (codec->prev_trail < 0) return TSSTORE_FAILURE;
+      }
+      else if (codec->prev_lead < 0)
+        return TSSTORE_FAILURE;
+      codec->prev_value ^= tsstore_bits_read(bits, 64 - codec->prev_lead - codec->prev_trail) << codec->prev_trail;
+    }
+  }
+  if (bits->pos > bits->cap * 8) return TSSTORE_FAILURE;
+  data->ts = codec->prev_ts;
+  memcpy(&data->value, &codec->prev_value, sizeof(data->value));
+  return TSSTORE_SUCCESS;
+}
+
+
+int tsstore_open(tsstore_t ** store, const char * dir)
+{
+  if (store == NULL || dir == NULL) return TSSTORE_FAILURE;
+  *store = NULL;
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) return TSSTORE_FAILURE;
+  tsstore_t * new_store = calloc(1, sizeof(tsstore_t));
+  if (new_store == NULL) return TSSTORE_FAILURE;
+  new_store->dir = strdup(dir);
+  if (new_store->dir == NULL)
+  {
+    free(new_store);
+    return TSSTORE_FAILURE;
+  }
+  *store = new_store;
+  return TSSTORE_SUCCESS;
+}
+
+// closes the files of 'series' and takes it off the open list, everything written to them was synced by its flush
+static void tsstore_files_close(tsstore_t * store, tsstore_series_t * series)
+{
+  if (series->seg_fd < 0) return;
+  close(series->seg_fd);
+  if (series->idx_fd >= 0) close(series->idx_fd);
+  series->seg_fd = series->idx_fd = -1;
+  if (series->open_prev) series->open_prev->open_next = series->open_next;
+  else store->open_head = series->open_next;
+  if (series->open_next) series->open_next->open_prev = series->open_prev;
+  else store->open_tail = series->open_prev;
+  series->open_prev = series->open_next = NULL;
+  store->open_count--;
+}
+
+/*
+ * Opens the segment (and with 'index' the index) of 'series' unless they are open already
+ * The files stay open for the life of the segment, the least recently written series closes its files
+ * when more than TSSTORE_OPEN_SERIES series are open
+ */
+static int tsstore_files_open(tsstore_t * store, tsstore_series_t * series, bool index)
+{
+  char path[PATH_MAX];
+  if (series->seg_fd < 0)
+  {
+    if (store->open_count == TSSTORE_OPEN_SERIES) tsstore_files_close(store, store->open_tail);
+    tsstore_path(store->dir, series->id, series->seq, "seg", path);
+    series->seg_fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    if (series->seg_fd < 0) return TSSTORE_FAILURE;
+    series->open_next = store->open_head;
+    if (store->open_head) store->open_head->open_prev = series;
+    else store->open_tail = series;
+    store->open_head = series;
+    store->open_count++;
+  }
+  else if (store->open_head != series)
+  {
+    // move to the front
+    series->open_prev->open_next = series->open_next;
+    if (series->open_next) series->open_next->open_prev = series->open_prev;
+    else store->open_tail = series->open_prev;
+    series->open_prev = NULL;
+    series->open_next = store->open_head;
+    store->open_head->open_prev = series;
+    store->open_head = series;
+  }
+  if (index && series->idx_fd < 0)
+  {
+    tsstore_path(store->dir, series->id, series->seq, "idx", path);
+    series->idx_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (series->idx_fd < 0) return TSSTORE_FAILURE;
+  }
+  return TSSTORE_SUCCESS;
+}
+
+int tsstore_close(tsstore_t ** store)
+{
+  if (store == NULL || *store == NULL) return TSSTORE_FAILURE;
+  int ret = tsstore_flush(*store);
+  for (int id = 0; id <= UINT16_MAX; id++)
+  {
+    tsstore_series_t * series = (*store)->series[id];
+    if (series == NULL) continue;
+    tsstore_files_close(*store, series);
+    for (tsstore_sealed_t * lists[] = {series->sealed, series->spare}, ** list = lists; list < lists + 2; list++)
+    {
+      while (*list != NULL)
+      {
+        tsstore_sealed_t * next = (*list)->next;
+        free((*list)->buf);
+        free(*list);
+        *list = next;
+      }
+    }
+    free(series->bits.buf);
+    free(series);
+  }
+  free((*store)->dir);
+  free(*store);
+  *store = NULL;
+  return ret;
+}
+
+// state of sensor 'id', a sensor seen for the first time starts a segment behind the existing ones
+static tsstore_series_t * tsstore_series_get(tsstore_t * store, sensor_id_t id)
+{
+  char path[PATH_MAX];
+  tsstore_series_t * series = store->series[id];
+  if (series != NULL) return series;
+  series = calloc(1, sizeof(tsstore_series_t));
+  if (series == NULL) return NULL;
+  series->id = id;
+  series->seg_fd = series->idx_fd = -1;
+  series->sealed_tail = &series->sealed;
+  for (series->seq = 0;; series->seq++)
+  {
+    tsstore_path(store->dir, id, series->seq, "seg", path);
+    if (access(path, F_OK) != 0) break;
+  }
+  store->series[id] = series;
+  return series;
+}
+
+/*
+ * Writes the block 'hdr' with payload 'buf' behind the sealed blocks of the segment of 'series'
+ * A sealed block also gets its index entry and the series moves on behind it (to a new segment when it is full)
+ */
+static int tsstore_write_block(tsstore_t * store, tsstore_series_t * series, tsstore_block_header_t * hdr, const uint8_t * buf, bool seal)
+{
+  if (tsstore_files_open(store, series, seal) != TSSTORE_SUCCESS) return TSSTORE_FAILURE;
+  off_t offset = series->seg_size;
+  if (pwrite(series->seg_fd, buf, hdr->nbytes, offset + sizeof(*hdr)) != (ssize_t)hdr->nbytes ||
+      pwrite(series->seg_fd, hdr, sizeof(*hdr), offset) != sizeof(*hdr))
+    return TSSTORE_FAILURE;
+  if (!seal) return TSSTORE_SUCCESS;
+
+  tsstore_index_entry_t entry = {hdr->min_ts, hdr->max_ts, offset, sizeof(*hdr) + hdr->nbytes};
+  if (write(series->idx_fd, &entry, sizeof(entry)) != sizeof(entry)) return TSSTORE_FAILURE;
+  series->seg_size += entry.size;
+  if (series->seg_size >= TSSTORE_SEGMENT_BYTES)
+  {
+    // the full segment is synced before its files are closed
+    if (fdatasync(series->seg_fd) != 0 || fdatasync(series->idx_fd) != 0) return TSSTORE_FAILURE;
+    tsstore_files_close(store, series);
+    series->seq++;
+    series->seg_size = 0;
+  }
+  return TSSTORE_SUCCESS;
+}
+
+// writes the sealed blocks and the open block of 'series' and syncs them
+static int tsstore_write_series(tsstore_t * store, tsstore_series_t * series)
+{
+  bool indexed = false;
+  while (series->sealed != NULL)
+  {
+    tsstore_sealed_t * block = series->sealed;
+    if (tsstore_write_block(store, series, &block->hdr, block->buf, true) != TSSTORE_SUCCESS) return TSSTORE_FAILURE;
+    indexed = series->idx_fd >= 0; // closed and synced when the segment got full
+    series->sealed = block->next;
+    if (series->sealed == NULL) series->sealed_tail = &series->sealed;
+    // the buffer takes the next full block
+    memset(block->buf, 0, block->hdr.nbytes);
+    block->next = series->spare;
+    series->spare = block;
+  }
+  if (series->hdr.count > 0)
+  {
+    series->hdr.magic = TSSTORE_BLOCK_MAGIC;
+    series->hdr.nbytes = (series->bits.pos + 7) / 8;
+    if (tsstore_write_block(store, series, &series->hdr, series->bits.buf, false) != TSSTORE_SUCCESS) return TSSTORE_FAILURE;
+  }
+  if (series->seg_fd >= 0 && fdatasync(series->seg_fd) != 0) return TSSTORE_FAILURE;
+  if (indexed && fdatasync(series->idx_fd) != 0) return TSSTORE_FAILURE;
+  return TSSTORE_SUCCESS;
+}
+
+/*
+ * Allocates what the current append of 'series' can need: room for a full block in the open block
+ * and a buffer for every block it fills
+ */
+static int tsstore_reserve(tsstore_series_t * series)
+{
+  if (series->bits.cap < TSSTORE_BLOCK_BYTES)
+  {
+    uint8_t * buf = realloc(series->bits.buf, TSSTORE_BLOCK_BYTES);
+    if (buf == NULL) return TSSTORE_FAILURE;
+    memset(buf + series->bits.cap, 0, TSSTORE_BLOCK_BYTES - series->bits.cap);
+    series->bits.buf = buf;
+    series->bits.cap = TSSTORE_BLOCK_BYTES;
+  }
+  uint32_t seals = (series->hdr.count + series->batch_count) / TSSTORE_BLOCK_READINGS, spares = 0;
+  for (tsstore_sealed_t * block = series->spare; block != NULL && spares < seals; block = block->next)
+    spares++;
+  for (; spares < seals; spares++)
+  {
+    tsstore_sealed_t * block = malloc(sizeof(tsstore_sealed_t));
+    if (block == NULL) return TSSTORE_FAILURE;
+    block->buf = calloc(1, TSSTORE_BLOCK_BYTES);
+    if (block->buf == NULL)
+    {
+      free(block);
+      return TSSTORE_FAILURE;
+    }
+    block->next = series->spare;
+    series->spare = block;
+  }
+  return TSSTORE_SUCCESS;
+}
+
+// moves the full open block of 'series' to its sealed blocks, a spare buffer becomes the new open block
+static void tsstore_seal(tsstore_series_t * series)
+{
+  tsstore_sealed_t * block = series->spare;
+  uint8_t * buf = block->buf;
+  series->spare = block->next;
+  series->hdr.magic = TSSTORE_BLOCK_MAGIC;
+  series->hdr.nbytes = (series->bits.pos + 7) / 8;
+  block->hdr = series->hdr;
+  block->buf = series->bits.buf;
+  block->next = NULL;
+  *series->sealed_tail = block;
+  series->sealed_tail = &block->next;
+  series->bits.buf = buf;
+  series->bits.pos = 0;
+  memset(&series->hdr, 0, sizeof(series->hdr));
+}
+
+/*
+ * The append is all or nothing: the series of the readings and every buffer the encoding needs are allocated first,
+ * encoding into reserved buffers can't fail. Nothing is written to the files before the next flush
+ */
+int tsstore_append(tsstore_t * store, const sensor_data_t * data, size_t count)
+{
+  tsstore_series_t * batch = NULL, * series;
+  int ret = TSSTORE_SUCCESS;
+  if (store == NULL) return TSSTORE_FAILURE;
+  for (size_t i = 0; i < count && ret == TSSTORE_SUCCESS; i++)
+  {
+    series = tsstore_series_get(store, data[i].id);
+    if (series == NULL)
+      ret = TSSTORE_FAILURE;
+    else if (series->batch_count++ == 0)
+    {
+      series->next_batch = batch;
+      batch = series;
+    }
+  }
+  for (series = batch; series != NULL && ret == TSSTORE_SUCCESS; series = series->next_batch)
+    ret = tsstore_reserve(series);
+  for (series = batch; series != NULL; series = series->next_batch)
+  {
+    series->batch_count = 0;
+    if (ret == TSSTORE_SUCCESS && !series->dirty)
+    {
+      series->dirty = true;
+      series->next_dirty = store->dirty;
+      store->dirty = series;
+    }
+  }
+  if (ret != TSSTORE_SUCCESS) return TSSTORE_FAILURE;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    series = store->series[data[i].id];
+    tsstore_block_header_t * hdr = &series->hdr;
+    // can't fail, the open block has room for a full block
+    tsstore_encode(&series->bits, &series->codec, &data[i], hdr->count == 0);
+    if (hdr->count == 0)
+    {
+      hdr->first_ts = hdr->min_ts = hdr->max_ts = data[i].ts;
+    }
+    if (data[i].ts < hdr->min_ts) hdr->min_ts = data[i].ts;
+    if (data[i].ts > hdr->max_ts) hdr->max_ts = data[i].ts;
+    if (++hdr->count == TSSTORE_BLOCK_READINGS) tsstore_seal(series);
+  }
+  return TSSTORE_SUCCESS;
+}
+
+int tsstore_flush(tsstore_t * store)
+{
+  tsstore_series_t * failed = NULL;
+  if (store == NULL) return TSSTORE_FAILURE;
+  while (store->dirty)
+  {
+    tsstore_series_t * series = store->dirty;
+    store->dirty = series->next_dirty;
+    series->next_dirty = NULL;
+    series->dirty = false;
+    if (tsstore_write_series(store, series) != TSSTORE_SUCCESS)
+    {
+      // keep it for the next flush
+      series->dirty = true;
+      series->next_dirty = failed;
+      failed = series;
+    }
+  }
+  store->dirty = failed;
+  return failed == NULL ? TSSTORE_SUCCESS : TSSTORE_FAILURE;
+}
+
+/*
+ * Reads the block at 'offset' of segment 'fd' and calls 'f' for its readings inside [from, to]
+ * Returns 1 when 'f' stopped the query, 0 to go on and TSSTORE_FAILURE for a damaged or incomplete block
+ */
+static int tsstore_read_block(int fd, off_t offset, off_t file_size, sensor_id_t id, sensor_ts_t from, sensor_ts_t to,
+                              tsstore_callback_t f, void * arg, tsstore_block_header_t * hdr)
+{
+  tsstore_bits_t bits = {NULL, 0, 0};
+  tsstore_codec_t codec;
+  int ret = 0;
+  if (pread(fd, hdr, sizeof(*hdr), offset) != sizeof(*hdr) || hdr->magic != TSSTORE_BLOCK_MAGIC ||
+      offset + (off_t)sizeof(*hdr) + hdr->nbytes > file_size)
+    return TSSTORE_FAILURE;
+  if (hdr->max_ts < from || hdr->min_ts > to || hdr->count == 0) return 0;
+  bits.cap = hdr->nbytes;
+  bits.buf = malloc(bits.cap);
+  if (bits.buf == NULL) return TSSTORE_FAILURE;
+  if (pread(fd, bits.buf, bits.cap, offset + sizeof(*hdr)) != (ssize_t)bits.cap)
+  {
+    free(bits.buf);
+    return TSSTORE_FAILURE;
+  }
+  for (uint32_t i = 0; i < hdr->count && ret == 0; i++)
+  {
+    sensor_data_t data;
+    data.id = id;
+    if (tsstore_decode(&bits, &codec, hdr, &data, i == 0) != TSSTORE_SUCCESS)
+      ret = TSSTORE_FAILURE;
+    else if (data.ts >= from && data.ts <= to && f(arg, &data) != 0)
+      ret = 1;
+  }
+  free(bits.buf);
+  return ret;
+}
+
+int tsstore_find_range(const char * dir, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, tsstore_callback_t f, void * arg)
+{
+  char path[PATH_MAX];
+  int ret = 0;
+  if (dir == NULL || f == NULL) return TSSTORE_FAILURE;
+  for (int seq = 0; ret == 0; seq++)
+  {
+    struct stat st;
+    tsstore_block_header_t hdr;
+    tsstore_index_entry_t entry;
+    off_t offset = 0;
+    tsstore_path(dir, id, seq, "seg", path);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT ? TSSTORE_SUCCESS : TSSTORE_FAILURE;
+    if (fstat(fd, &st) != 0)
+    {
+      close(fd);
+      return TSSTORE_FAILURE;
+    }
+    // sealed blocks through the index, blocks outside the range are not read at all
+    tsstore_path(dir, id, seq, "idx", path);
+    FILE * idx = fopen(path, "rb");
+    while (ret == 0 && idx != NULL && fread(&entry, sizeof(entry), 1, idx) == 1)
+    {
+      if (entry.max_ts >= from && entry.min_ts <= to)
+        ret = tsstore_read_block(fd, entry.offset, st.st_size, id, from, to, f, arg, &hdr);
+      offset = entry.offset + entry.size;
+    }
+    if (idx != NULL) fclose(idx);
+    // then the blocks that are not indexed yet, the open block last
+    while (ret == 0 && offset < st.st_size)
+    {
+      int block = tsstore_read_block(fd, offset, st.st_size, id, from, to, f, arg, &hdr);
+      if (block == TSSTORE_FAILURE) break; // torn or damaged tail
+      ret = block;
+      offset += sizeof(hdr) + hdr.nbytes;
+    }
+    close(fd);
+  }
+  return ret == TSSTORE_FAILURE ? TSSTORE_FAILURE : TSSTORE_SUCCESS;
+}
@@ -0,0 +1,75 @@
+#ifndef _TSSTORE_H_
+#define _TSSTORE_H_
+
+#include <stddef.h>
+#include "config.h"
+
+#define TSSTORE_FAILURE -1
+#define TSSTORE_SUCCESS 0
+
+#ifndef TSSTORE_BLOCK_READINGS
+  #define TSSTORE_BLOCK_READINGS 1024 // readings compressed together in one block
+#endif
+
+#ifndef TSSTORE_SEGMENT_BYTES
+  #define TSSTORE_SEGMENT_BYTES (4 << 20) // a sensor starts a new segment file once its segment is this large
+#endif
+
+#ifndef TSSTORE_OPEN_SERIES
+  #define TSSTORE_OPEN_SERIES 128 // sensors that keep their segment and index open, two descriptors each
+#endif
+
+/*
+ * Append-only time-series store, every sensor has its own segment files in the store directory:
+ *   <id>_<seq>.seg : blocks of up to TSSTORE_BLOCK_READINGS readings, timestamps delta-of-delta encoded
+ *                    and values XOR compressed against the previous value (Gorilla style)
+ *   <id>_<seq>.idx : sparse time index, one entry per sealed block with its time range and offset
+ * The last block of a segment stays open and is rewritten in place until it is full
+ * Readings are kept in memory until tsstore_flush writes them and syncs the files with fdatasync
+ */
+typedef struct tsstore tsstore_t;
+
+// row callback, gets the caller's 'arg' and one reading, return non-zero to stop the query
+typedef int (*tsstore_callback_t)(void * arg, const sensor_data_t * data);
+
+
+/*
+ * Opens the store in directory 'dir', the directory is created if it doesn't exist
+ * Earlier segments are kept, new readings go to new segments
+ * Returns TSSTORE_SUCCESS on success and TSSTORE_FAILURE if an error occured
+ */
+int tsstore_open(tsstore_t ** store, const char * dir);
+
+
+/*
+ * Writes all buffered readings and frees 'store', '*store' is set to NULL
+ * Returns TSSTORE_SUCCESS on success and TSSTORE_FAILURE if an error occured
+ */
+int tsstore_close(tsstore_t ** store);
+
+
+/*
+ * Appends the 'count' readings in 'data' to the segments of their sensors
+ * The readings of one sensor are expected in time order, they are kept in memory until tsstore_flush
+ * Returns TSSTORE_SUCCESS on success and TSSTORE_FAILURE if an error occured, none of the readings is appended then
+ */
+int tsstore_append(tsstore_t * store, const sensor_data_t * data, size_t count);
+
+
+/*
+ * Writes the full blocks and the open block of every sensor that got new readings since the last flush
+ * and makes them durable
+ * Returns TSSTORE_SUCCESS on success and TSSTORE_FAILURE if an error occured
+ */
+int tsstore_flush(tsstore_t * store);
+
+
+/*
+ * Calls 'f' for every stored reading of sensor 'id' with a timestamp from 'from' up to and including 'to', in the order they were appended
+ * Only blocks whose time range overlaps are read, 'f' can stop the query by returning non-zero
+ * Returns TSSTORE_SUCCESS on success and TSSTORE_FAILURE if an error occured
+ */
+int tsstore_find_range(const char * dir, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, tsstore_callback_t f, void * arg);
+
+
+#endif  //_TSSTORE_H_